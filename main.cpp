@@ -1,9 +1,28 @@
 #include <iostream>
 #include <functional>
 #include <cmath>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 
 #include "src/asi.h"
+#include "src/asi_2d.h"
+#include "src/parallel_asi.h"
+#include "src/gauss_kronrod.h"
 #include "src/bucket_quadtrees.h"
+#include "src/query_cache.h"
+#include "src/query_cursor.h"
+#include "src/density_raster.h"
+#include "src/kd_tree.h"
+#include "src/r_tree.h"
+#include "src/leaf_layout.h"
+#include "src/sharded_index.h"
+#include "src/moving_index.h"
+#include "src/nd_tree.h"
+#include "src/query_stats.h"
+#include "src/tree_stats.h"
+#include "src/capacity_tuner.h"
 #include "src/utilities/utest.h"
 #include "src/utilities/point_reader.hpp"
 #include "src/utilities/timer.hpp"
@@ -13,12 +32,25 @@ UTEST_STATE();
 
 void assign_01();
 void assign_02();
+int bench(const std::string& name);
+void bench_direct_search();
+void bench_engines();
+void bench_r_tree();
+void bench_leaf_layout();
+void bench_sharded();
+void bench_moving();
+void bench_capacity();
+void bench_quadrature();
 
 int main(const int argc, const char* const argv[])
 {
     // check if there is any argument
     if (argc > 1)
     {
+        if (std::string(argv[1]) == "--bench" && argc > 2)
+        {
+            return bench(argv[2]);
+        }
         return utest_main(argc, argv);
     }
     // assign_01();
@@ -82,10 +114,10 @@ void assign_02()
     alg::DirectSearch qt(points);
     qt.divide(5000);
     sf::MplWriter<alg::Point, alg::Rectangle> writer1("plot1.py");
-    for (auto r : qt.getResult())
+    for (const alg::CellView cell : qt.getResult())
     {
-        writer1 << std::get<0>(r);
-        writer1 << std::get<1>(r);
+        writer1 << cell.rect;
+        writer1 << std::vector<alg::Point>(cell.points.begin(), cell.points.end());
     }
     sf::Timer timer2;
     timer2.start();
@@ -96,3 +128,391 @@ void assign_02()
     writer1_query << result1;
     timer.stop();
 }
+
+int bench(const std::string& name)
+{
+    if (name == "direct_search")
+    {
+        bench_direct_search();
+        return 0;
+    }
+    if (name == "engines")
+    {
+        bench_engines();
+        return 0;
+    }
+    if (name == "r_tree")
+    {
+        bench_r_tree();
+        return 0;
+    }
+    if (name == "leaf_layout")
+    {
+        bench_leaf_layout();
+        return 0;
+    }
+    if (name == "sharded")
+    {
+        bench_sharded();
+        return 0;
+    }
+    if (name == "moving")
+    {
+        bench_moving();
+        return 0;
+    }
+    if (name == "capacity")
+    {
+        bench_capacity();
+        return 0;
+    }
+    if (name == "quadrature")
+    {
+        bench_quadrature();
+        return 0;
+    }
+    std::cerr << "Unknown benchmark: " << name << std::endl;
+    return 1;
+}
+
+void bench_direct_search()
+{
+    // crossover between the brute force scans and the quadtree as the query grows
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(2000000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 5000);
+    alg::DirectSearch direct(points);
+    alg::ParallelDirectSearch parallel(points);
+    constexpr int repeats = 10;
+    constexpr double sizes[5] = {0.01, 0.1, 0.5, 1.0, 4.0};
+    sf::Timer timer;
+    for (const double size : sizes)
+    {
+        const alg::Rectangle rect{alg::Point{-size, -size}, alg::Point{size, size}};
+        std::vector<alg::Rectangle> rects(repeats, rect);
+        size_t hits = 0;
+        timer.start("QuadTree half width " + std::to_string(size));
+        for (int i = 0; i < repeats; ++i)
+        {
+            std::vector<alg::Point> result{};
+            root.query(rect, result);
+            hits = result.size();
+        }
+        timer.stop();
+        timer.start("DirectSearch half width " + std::to_string(size));
+        for (int i = 0; i < repeats; ++i)
+        {
+            hits = direct.query(rect).size();
+        }
+        timer.stop();
+        timer.start("ParallelDirectSearch half width " + std::to_string(size));
+        for (int i = 0; i < repeats; ++i)
+        {
+            hits = parallel.query(rect).size();
+        }
+        timer.stop();
+        timer.start("ParallelDirectSearch batch half width " + std::to_string(size));
+        hits = parallel.queryBatch(rects).front().size();
+        timer.stop();
+        timer.start("ParallelDirectSearch count half width " + std::to_string(size));
+        for (int i = 0; i < repeats; ++i)
+        {
+            hits = parallel.count(rect);
+        }
+        timer.stop();
+        std::cout << "hits: " << hits << std::endl;
+    }
+}
+
+template <typename Engine>
+void time_engine(const std::string& name, Engine& engine, const std::vector<alg::Rectangle>& rects)
+{
+    sf::Timer timer;
+    size_t hits = 0;
+    timer.start(name);
+    for (const alg::Rectangle& rect : rects)
+    {
+        std::vector<alg::Point> result{};
+        engine.query(rect, result);
+        hits += result.size();
+    }
+    timer.stop();
+    std::cout << "hits: " << hits << std::endl;
+}
+
+void bench_engines()
+{
+    // same queries against every engine, on the clustered swe data and on a synthetic mixture
+    std::vector<std::pair<std::string, std::vector<alg::Point>>> datasets{};
+    datasets.emplace_back("swe", sf::readCsvPoints<alg::Point>("test_data/swe.csv"));
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(1000000, alg::Point{0.0, 0.0});
+    generator.addUniformPoints(1000000, alg::Point{10.0, 10.0});
+    datasets.emplace_back("synthetic", generator.takePoints());
+    for (auto& [name, points] : datasets)
+    {
+        // query rectangles centred on data points, a tenth of the bounding box wide
+        alg::QuadTree root(points, 64);
+        const alg::Rectangle box = root.rect;
+        const double w = (box.topRight.x - box.bottomLeft.x) / 20;
+        const double h = (box.topRight.y - box.bottomLeft.y) / 20;
+        std::vector<alg::Rectangle> rects{};
+        for (size_t i = 0; i < points.size(); i += points.size() / 200 + 1)
+        {
+            const alg::Point c = points[i];
+            rects.emplace_back(alg::Point{c.x - w, c.y - h}, alg::Point{c.x + w, c.y + h});
+        }
+        alg::DirectSearch direct(points);
+        alg::GridIndex grid(points);
+        alg::SortedSweep sweep(points);
+        alg::KdTree kd(points, 64);
+        alg::BucketTree<2> bucket(points, 64);
+        time_engine(name + " QuadTree", root, rects);
+        time_engine(name + " GridIndex", grid, rects);
+        time_engine(name + " SortedSweep", sweep, rects);
+        time_engine(name + " KdTree", kd, rects);
+        time_engine(name + " BucketTree<2>", bucket, rects);
+        time_engine(name + " DirectSearch", direct, rects);
+    }
+}
+
+void bench_r_tree()
+{
+    // bulk load and query of a large set of small boxes
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(4000000, alg::Point{0.0, 0.0});
+    const auto corners = generator.takePoints();
+    std::vector<alg::Rectangle> rects{};
+    rects.reserve(corners.size() / 2);
+    for (size_t i = 0; i < corners.size(); i += 2)
+    {
+        const alg::Point c = corners[i];
+        rects.emplace_back(c, alg::Point{c.x + std::abs(corners[i + 1].x) * 1e-3, c.y + std::abs(corners[i + 1].y) * 1e-3});
+    }
+    sf::Timer timer;
+    timer.start("RTree bulk load of " + std::to_string(rects.size()) + " rectangles");
+    const alg::RTree tree(rects);
+    timer.stop();
+    size_t hits = 0;
+    timer.start("RTree 1000 intersection queries");
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        const alg::Point c = corners[i * 2];
+        std::vector<size_t> ids{};
+        tree.intersecting(alg::Rectangle{c, alg::Point{c.x + 0.05, c.y + 0.05}}, ids);
+        hits += ids.size();
+    }
+    timer.stop();
+    timer.start("RTree 100000 stabbing queries");
+    for (size_t i = 0; i < 100000; ++i)
+    {
+        std::vector<size_t> ids{};
+        tree.stabbing(corners[i * 2 + 1], ids);
+        hits += ids.size();
+    }
+    timer.stop();
+    std::cout << "hits: " << hits << std::endl;
+}
+
+void bench_leaf_layout()
+{
+    // insertion, Morton and Hilbert leaf order on the swe data and on larger synthetic sets
+    std::vector<std::pair<std::string, std::vector<alg::Point>>> datasets{};
+    datasets.emplace_back("swe", sf::readCsvPoints<alg::Point>("test_data/swe.csv"));
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(1000000, alg::Point{0.0, 0.0});
+    generator.addNormalPoints(1000000, alg::Point{5.0, 3.0});
+    datasets.emplace_back("clusters", generator.takePoints());
+    generator.addUniformPoints(8000000, alg::Point{0.0, 0.0});
+    datasets.emplace_back("uniform", generator.takePoints());
+    const std::pair<std::string, alg::LeafOrder> orders[3] = {
+        {"insertion", alg::LeafOrder::Insertion}, {"morton", alg::LeafOrder::Morton},
+        {"hilbert", alg::LeafOrder::Hilbert}
+    };
+    for (auto& [name, points] : datasets)
+    {
+        alg::QuadTree root(points, 64);
+        const alg::Rectangle box = root.rect;
+        const double w = (box.topRight.x - box.bottomLeft.x) / 20;
+        const double h = (box.topRight.y - box.bottomLeft.y) / 20;
+        std::vector<alg::Rectangle> rects{};
+        for (size_t i = 0; i < points.size(); i += points.size() / 1000 + 1)
+        {
+            const alg::Point c = points[i];
+            rects.emplace_back(alg::Point{c.x - w, c.y - h}, alg::Point{c.x + w, c.y + h});
+        }
+        time_engine(name + " QuadTree", root, rects);
+        for (const auto& [orderName, order] : orders)
+        {
+            const alg::LeafLayout layout(root, order);
+            time_engine(name + " " + orderName, layout, rects);
+            size_t runs = 0;
+            size_t pages = 0;
+            for (const alg::Rectangle& rect : rects)
+            {
+                const auto [r, p] = layout.footprint(rect);
+                runs += r;
+                pages += p;
+            }
+            std::cout << "runs per query: " << static_cast<double>(runs) / rects.size()
+                << " pages per query: " << static_cast<double>(pages) / rects.size() << std::endl;
+        }
+    }
+}
+
+void bench_sharded()
+{
+    // query throughput of one tree against one shard per NUMA node, with as many clients as hardware threads
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(4000000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    const unsigned clients = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<alg::Rectangle> rects{};
+    for (size_t i = 0; i < 4000; ++i)
+    {
+        const alg::Point c = points[i * 997 % points.size()];
+        rects.emplace_back(alg::Point{c.x - 0.1, c.y - 0.1}, alg::Point{c.x + 0.1, c.y + 0.1});
+    }
+    const auto run = [&](const std::string& name, auto&& query)
+    {
+        sf::Timer timer;
+        timer.start(name + " with " + std::to_string(clients) + " clients");
+        std::vector<std::thread> threads{};
+        for (unsigned t = 0; t < clients; ++t)
+        {
+            threads.emplace_back([&, t]
+            {
+                for (size_t i = t; i < rects.size(); i += clients)
+                {
+                    std::vector<alg::Point> result{};
+                    query(rects[i], result);
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        timer.stop();
+    };
+    alg::QuadTree root(points, 256);
+    run("QuadTree", [&](const alg::Rectangle& rect, std::vector<alg::Point>& result) { root.query(rect, result); });
+    alg::ShardedIndex index(points, alg::ShardedIndex::nodeCount(), 256);
+    run("ShardedIndex", [&](const alg::Rectangle& rect, std::vector<alg::Point>& result) { index.query(rect, result); });
+}
+
+void bench_moving()
+{
+    // 100k assets taking small random steps while another thread keeps querying
+    constexpr uint64_t assets = 100000;
+    constexpr size_t steps = 10;
+    const alg::Rectangle world{alg::Point{-1.0, -1.0}, alg::Point{1.0, 1.0}};
+    alg::MovingIndex index(world, 60.0, 10, 64);
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(assets, alg::Point{0.0, 0.0});
+    auto positions = generator.takePoints();
+    std::mt19937_64 rng(2024);
+    std::normal_distribution<> step(0.0, 1e-3);
+    std::atomic<bool> done{false};
+    std::atomic<size_t> queries{0};
+    std::thread reader([&]
+    {
+        while (!done)
+        {
+            std::vector<uint64_t> ids{};
+            index.queryLatest(alg::Rectangle{alg::Point{-0.1, -0.1}, alg::Point{0.1, 0.1}}, ids);
+            ++queries;
+        }
+    });
+    sf::Timer timer;
+    timer.start(std::to_string(assets * steps) + " updates");
+    for (size_t s = 0; s < steps; ++s)
+    {
+        for (uint64_t id = 0; id < assets; ++id)
+        {
+            alg::Point& p = positions[id];
+            p.x = std::clamp(p.x + step(rng), -1.0, 1.0);
+            p.y = std::clamp(p.y + step(rng), -1.0, 1.0);
+            index.update(id, p, static_cast<double>(s) * 6.0);
+        }
+    }
+    timer.stop();
+    done = true;
+    reader.join();
+    std::cout << "concurrent queries: " << queries << std::endl;
+}
+
+void bench_capacity()
+{
+    // capacity curve of the quadtree on the swe data, for queries of a twentieth and of a fifth of the bounding box
+    auto points = sf::readCsvPoints<alg::Point>("test_data/swe.csv");
+    const alg::QuadTree root(points, 5000);
+    const alg::Rectangle box = root.rect;
+    for (const double fraction : {0.05, 0.2})
+    {
+        const double w = (box.topRight.x - box.bottomLeft.x) * fraction / 2;
+        const double h = (box.topRight.y - box.bottomLeft.y) * fraction / 2;
+        std::vector<alg::Rectangle> rects{};
+        for (size_t i = 0; i < points.size(); i += points.size() / 200 + 1)
+        {
+            const alg::Point c = points[i];
+            rects.emplace_back(alg::Point{c.x - w, c.y - h}, alg::Point{c.x + w, c.y + h});
+        }
+        const alg::CapacityTuner tuner(points, rects);
+        const alg::CapacityTuning tuning = tuner.tune(4, 16384);
+        std::cout << "query width " << fraction << " of the bounding box" << std::endl;
+        for (const alg::CapacityTiming& timing : tuning.curve)
+        {
+            std::cout << "capacity " << timing.capacity << ": " << timing.seconds * 1e3 << "ms" << std::endl;
+        }
+        std::cout << "best capacity: " << tuning.capacity << std::endl;
+    }
+}
+
+template <typename Engine>
+void time_quadrature(const std::string& name, const Engine& engine, const double exact)
+{
+    // repeated until at least 50ms have passed, so cheap integrations are timed reliably
+    int counter = 0;
+    const double value = engine.integrate(&counter);
+    int repeats = 0;
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{};
+    do
+    {
+        int _ = 0;
+        engine.integrate(&_);
+        ++repeats;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    while (elapsed.count() < 0.05);
+    std::cout << name << ": evaluations " << counter << " error " << std::abs(value - exact) << " time "
+        << elapsed.count() / repeats * 1e6 << "us" << std::endl;
+}
+
+void bench_quadrature()
+{
+    // evaluations, error and time of Simpson's rule against Gauss-Kronrod on the integrands of the tests and assign_01
+    const std::pair<std::string, std::function<double(double)>> integrands[2] = {
+        {"x on [0, 1]", [](const double x) { return x; }},
+        {"x + cos(x^5) on [0, pi]", [](const double x) { return x + cos(pow(x, 5)); }}
+    };
+    const double bounds[2] = {1.0, M_PI};
+    for (int i = 0; i < 2; ++i)
+    {
+        const auto& [name, f] = integrands[i];
+        const double b = bounds[i];
+        const double exact = alg::GaussKronrod<std::function<double(double)>, alg::G10K21>(f, 0, b, 1e-14).integrate();
+        for (const double tol : {1e-2, 1e-4, 1e-6, 1e-8, 1e-10})
+        {
+            std::cout << name << " tolerance " << tol << std::endl;
+            time_quadrature("  ASI", alg::ASI(f, 0, b, tol), exact);
+            time_quadrature("  ReuseASI", alg::ReuseASI(f, 0, b, tol), exact);
+            time_quadrature("  GlobalASI", alg::GlobalASI(f, 0, b, tol), exact);
+            time_quadrature("  GaussKronrod G7K15", alg::GaussKronrod(f, 0, b, tol), exact);
+            time_quadrature("  GaussKronrod G10K21",
+                            alg::GaussKronrod<std::function<double(double)>, alg::G10K21>(f, 0, b, tol), exact);
+        }
+    }
+}
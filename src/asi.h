@@ -4,16 +4,30 @@
 
 #ifndef ASI_H
 #define ASI_H
+#include <algorithm>
 #include <functional>
 #include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "utilities/utest.h"
 
 namespace alg
 {
     /**
-     * Adaptive Simpson's Rule
+     * Adaptive Simpson's Rule.
+     *
+     * The integrand is stored by value as an F, so a lambda passed directly is deduced as its own type and inlined into
+     * the rule. The default F, std::function, keeps the type erased interface for callers that need one.
+     *
+     * F may also be a batch integrand, callable as `f(const double* x, double* y, size_t n)` to set y[i] = f(x[i]). The
+     * intervals are then refined breadth first: every step gathers the new abscissas of all pending intervals and
+     * evaluates them in one call. The same intervals are accepted and their values are summed in the same order as in
+     * the scalar rule, so the result is identical, while the counter counts each evaluated point once.
      */
+    template <typename F = std::function<double(double)>>
     class ASI
     {
     public:
@@ -25,8 +39,7 @@ namespace alg
          * @param b: upper bound
          * @param tol: tolerance
          */
-        ASI(const std::function<double(double)>& f, const double a, const double b,
-            const double tol): f(f), a(a), b(b), tol(tol)
+        ASI(F f, const double a, const double b, const double tol): f(std::move(f)), a(a), b(b), tol(tol)
         {
         }
 
@@ -39,7 +52,14 @@ namespace alg
         double integrate(int* counter) const
         {
             checkTol();
-            return call(a, b, tol, counter);
+            if constexpr (BATCH)
+            {
+                return callBatch(counter);
+            }
+            else
+            {
+                return call(a, b, tol, counter);
+            }
         }
 
         /**
@@ -65,7 +85,30 @@ namespace alg
         }
 
     private:
-        const std::function<double(double)> f;
+        static constexpr bool BATCH = std::is_invocable_v<const F&, const double*, double*, size_t>;
+
+        struct Pending
+        {
+            double a;
+            double b;
+            double fa;
+            double fm;
+            double fb;
+            // Simpson estimate of [a, b]
+            double whole;
+            double tol;
+            size_t node;
+        };
+
+        struct Node
+        {
+            double value;
+            // children in the node list, 0 for an accepted interval
+            size_t left;
+            size_t right;
+        };
+
+        const F f;
         const double a;
         const double b;
         double tol;
@@ -91,6 +134,66 @@ namespace alg
             return call(a, mid, tol / 2, counter) + call(mid, b, tol / 2, counter);
         }
 
+        /**
+         * breadth first refinement with one batch call per step
+         */
+        [[nodiscard]] double callBatch(int* counter) const
+        {
+            std::vector<double> x = {a, (a + b) / 2, b};
+            std::vector<double> y(3);
+            f(x.data(), y.data(), x.size());
+            *counter += 3;
+            std::vector<Node> nodes = {Node{0.0, 0, 0}};
+            std::vector<Pending> pending = {
+                Pending{a, b, y[0], y[1], y[2], 1.0 / 6 * (b - a) * (y[0] + 4 * y[1] + y[2]), tol, 0}
+            };
+            std::vector<Pending> next{};
+            while (!pending.empty())
+            {
+                x.resize(2 * pending.size());
+                y.resize(2 * pending.size());
+                for (size_t i = 0; i < pending.size(); ++i)
+                {
+                    const double mid = (pending[i].a + pending[i].b) / 2;
+                    x[2 * i] = (pending[i].a + mid) / 2;
+                    x[2 * i + 1] = (mid + pending[i].b) / 2;
+                }
+                f(x.data(), y.data(), x.size());
+                *counter += static_cast<int>(x.size());
+                next.clear();
+                for (size_t i = 0; i < pending.size(); ++i)
+                {
+                    const Pending& p = pending[i];
+                    const double mid = (p.a + p.b) / 2;
+                    const double left = 1.0 / 6 * (mid - p.a) * (p.fa + 4 * y[2 * i] + p.fm);
+                    const double right = 1.0 / 6 * (p.b - mid) * (p.fm + 4 * y[2 * i + 1] + p.fb);
+                    const double i_2 = left + right;
+                    if (std::abs(p.whole - i_2) < 15 * p.tol)
+                    {
+                        nodes[p.node].value = i_2;
+                        continue;
+                    }
+                    nodes[p.node].left = nodes.size();
+                    nodes[p.node].right = nodes.size() + 1;
+                    next.push_back(Pending{p.a, mid, p.fa, y[2 * i], p.fm, left, p.tol / 2, nodes.size()});
+                    next.push_back(Pending{mid, p.b, p.fm, y[2 * i + 1], p.fb, right, p.tol / 2, nodes.size() + 1});
+                    nodes.push_back(Node{0.0, 0, 0});
+                    nodes.push_back(Node{0.0, 0, 0});
+                }
+                pending.swap(next);
+            }
+            return sum(nodes, 0);
+        }
+
+        /**
+         * sum of the accepted intervals below a node, in the order of `call()`
+         */
+        static double sum(const std::vector<Node>& nodes, const size_t node)
+        {
+            if (nodes[node].left == 0) return nodes[node].value;
+            return sum(nodes, nodes[node].left) + sum(nodes, nodes[node].right);
+        }
+
         void checkTol() const
         {
             if (tol <= 0)
@@ -99,9 +202,462 @@ namespace alg
             }
         }
     };
+
+    /**
+     * Integrated value with its error estimate
+     */
+    struct Integral
+    {
+        double value;
+        // sum of the error estimates |I_2 - I| / 15 of the accepted intervals and of the unfinished ones
+        double error;
+        // false if the evaluation budget ran out or an interval hit the depth limit before meeting its tolerance
+        bool converged;
+    };
+
+    /**
+     * Adaptive Simpson's Rule without recursion.
+     *
+     * Accepts the same intervals as ASI, but keeps the pending intervals on a preallocated stack, so the call depth
+     * stays constant. Intervals deeper than `maxDepth` are accepted as they are, and once `maxEvaluations` would be
+     * exceeded the pending intervals contribute the estimate their parent computed for them. In both cases the result
+     * is marked as not converged and its error estimate includes those intervals.
+     */
+    template <typename F = std::function<double(double)>>
+    class IterativeASI
+    {
+    public:
+        /**
+         * Constructor of the iterative Adaptive Simpson's Rule. After construction, call `integrate()` to get the
+         * integrated value.
+         *
+         * @param f: function to integrate
+         * @param a: lower bound
+         * @param b: upper bound
+         * @param tol: tolerance
+         * @param maxDepth: maximum number of times an interval is halved
+         * @param maxEvaluations: maximum number of function evaluations
+         */
+        IterativeASI(F f, const double a, const double b, const double tol, const int maxDepth = 50,
+                     const int maxEvaluations = 1000000) : f(std::move(f)), a(a), b(b), tol(tol),
+            maxDepth(maxDepth), maxEvaluations(maxEvaluations)
+        {
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(int* counter) const
+        {
+            return integrateWithError(counter).value;
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @return integrated value
+         */
+        double integrate() const
+        {
+            int _ = 0;
+            return integrate(&_);
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value, error estimate and whether the tolerance was met
+         */
+        Integral integrateWithError(int* counter) const
+        {
+            checkTol();
+            Integral result{0.0, 0.0, true};
+            std::vector<Frame> stack{};
+            // depth first with the right half pushed first never holds more than one frame per level
+            stack.reserve(static_cast<size_t>(maxDepth) + 2);
+            stack.push_back(Frame{a, b, tol, 0, 0.0, 0.0});
+            int used = 0;
+            while (!stack.empty())
+            {
+                const Frame frame = stack.back();
+                if (frame.depth > 0 && used + 9 > maxEvaluations)
+                {
+                    // out of budget, every pending interval keeps its parent's estimate
+                    for (const Frame& pending : stack)
+                    {
+                        result.value += pending.estimate;
+                        result.error += pending.error;
+                    }
+                    result.converged = false;
+                    break;
+                }
+                stack.pop_back();
+                used += 9;
+                *counter += 9;
+                const double mid = (frame.a + frame.b) / 2;
+                const double left = I(frame.a, mid);
+                const double right = I(mid, frame.b);
+                const double i_1 = I(frame.a, frame.b);
+                const double i_2 = left + right;
+                const double error = std::abs(i_1 - i_2);
+                if (error < 15 * frame.tol || frame.depth >= maxDepth)
+                {
+                    result.value += i_2;
+                    result.error += error / 15;
+                    result.converged = result.converged && error < 15 * frame.tol;
+                    continue;
+                }
+                stack.push_back(Frame{mid, frame.b, frame.tol / 2, frame.depth + 1, right, error / 30});
+                stack.push_back(Frame{frame.a, mid, frame.tol / 2, frame.depth + 1, left, error / 30});
+            }
+            return result;
+        }
+
+        /**
+         * set tolerance
+         *
+         * @param tol: tolerance
+         */
+        IterativeASI setTol(const double tol)
+        {
+            this->tol = tol;
+            return *this;
+        }
+
+    private:
+        struct Frame
+        {
+            double a;
+            double b;
+            double tol;
+            int depth;
+            // the parent's Simpson estimate of this interval and its share of the parent's error
+            double estimate;
+            double error;
+        };
+
+        const F f;
+        const double a;
+        const double b;
+        double tol;
+        const int maxDepth;
+        const int maxEvaluations;
+
+        [[nodiscard]] double I(const double a, const double b) const
+        {
+            return 1.0 / 6 * (b - a) * (f(a) + 4 * f((a + b) / 2) + f(b));
+        }
+
+        void checkTol() const
+        {
+            if (tol <= 0)
+            {
+                throw std::invalid_argument("Tolerance must be positive.");
+            }
+            if (maxDepth < 0 || maxEvaluations < 9)
+            {
+                throw std::invalid_argument("Depth limit must not be negative and the budget must allow one step.");
+            }
+        }
+    };
+
+    /**
+     * Adaptive Simpson's Rule evaluating every abscissa once.
+     *
+     * Accepts the same intervals as ASI and returns the same value, bit for bit. Every level passes f(a), f(mid), f(b)
+     * and the Simpson estimate of each half down to its children, so a level costs the two new quarter points instead
+     * of the 9 evaluations of `I()` and `I_2()`.
+     */
+    template <typename F = std::function<double(double)>>
+    class ReuseASI
+    {
+    public:
+        /**
+         * Constructor of the reusing Adaptive Simpson's Rule. After construction, call `integrate()` to get the
+         * integrated value.
+         *
+         * @param f: function to integrate
+         * @param a: lower bound
+         * @param b: upper bound
+         * @param tol: tolerance
+         */
+        ReuseASI(F f, const double a, const double b, const double tol) : f(std::move(f)), a(a), b(b), tol(tol)
+        {
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(int* counter) const
+        {
+            checkTol();
+            const double mid = (a + b) / 2;
+            const double fa = f(a);
+            const double fm = f(mid);
+            const double fb = f(b);
+            *counter += 3;
+            return call(a, b, fa, fm, fb, S(a, b, fa, fm, fb), tol, counter);
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @return integrated value
+         */
+        double integrate() const
+        {
+            int _ = 0;
+            return integrate(&_);
+        }
+
+        /**
+         * set tolerance
+         *
+         * @param tol: tolerance
+         */
+        ReuseASI setTol(const double tol)
+        {
+            this->tol = tol;
+            return *this;
+        }
+
+    private:
+        const F f;
+        const double a;
+        const double b;
+        double tol;
+
+        /**
+         * Simpson's rule from known values, the same expression as ASI::I()
+         */
+        static double S(const double a, const double b, const double fa, const double fm, const double fb)
+        {
+            return 1.0 / 6 * (b - a) * (fa + 4 * fm + fb);
+        }
+
+        /**
+         * @param fa: f(a)
+         * @param fm: f((a + b) / 2)
+         * @param fb: f(b)
+         * @param whole: Simpson estimate of [a, b]
+         */
+        [[nodiscard]] double call(const double a, const double b, const double fa, const double fm, const double fb,
+                                  const double whole, const double tol, int* counter) const
+        {
+            const double mid = (a + b) / 2;
+            const double fl = f((a + mid) / 2);
+            const double fr = f((mid + b) / 2);
+            *counter += 2;
+            const double left = S(a, mid, fa, fl, fm);
+            const double right = S(mid, b, fm, fr, fb);
+            const double i_2 = left + right;
+            if (std::abs(whole - i_2) < 15 * tol) return i_2;
+            return call(a, mid, fa, fl, fm, left, tol / 2, counter) + call(mid, b, fm, fr, fb, right, tol / 2, counter);
+        }
+
+        void checkTol() const
+        {
+            if (tol <= 0)
+            {
+                throw std::invalid_argument("Tolerance must be positive.");
+            }
+        }
+    };
+
+    /**
+     * Globally adaptive Simpson's Rule.
+     *
+     * Instead of halving the tolerance on every level, the intervals are kept in a max-heap keyed by their error
+     * estimate |I_2 - I| / 15 and the worst one is always refined, until the summed error is below `tol` or the
+     * evaluation budget runs out. Effort goes where the error is, so easy regions are not refined past what the total
+     * needs. Every abscissa is evaluated once, a split costs 4 evaluations.
+     */
+    template <typename F = std::function<double(double)>>
+    class GlobalASI
+    {
+    public:
+        /**
+         * Constructor of the globally adaptive Simpson's Rule. After construction, call `integrate()` to get the
+         * integrated value.
+         *
+         * @param f: function to integrate
+         * @param a: lower bound
+         * @param b: upper bound
+         * @param tol: tolerance of the summed error estimate
+         * @param maxEvaluations: maximum number of function evaluations
+         */
+        GlobalASI(F f, const double a, const double b, const double tol, const int maxEvaluations = 1000000) :
+            f(std::move(f)), a(a), b(b), tol(tol), maxEvaluations(maxEvaluations)
+        {
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(int* counter) const
+        {
+            return integrateWithError(counter).value;
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @return integrated value
+         */
+        double integrate() const
+        {
+            int _ = 0;
+            return integrate(&_);
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value, error estimate and whether the tolerance was met
+         */
+        Integral integrateWithError(int* counter) const
+        {
+            checkTol();
+            const double mid = (a + b) / 2;
+            const double fa = f(a);
+            const double fl = f((a + mid) / 2);
+            const double fm = f(mid);
+            const double fr = f((mid + b) / 2);
+            const double fb = f(b);
+            *counter += 5;
+            int used = 5;
+            std::vector<Interval> heap = {interval(a, b, fa, fl, fm, fr, fb)};
+            double error = heap.front().error;
+            const auto less = [](const Interval& l, const Interval& r) { return l.error < r.error; };
+            bool converged = true;
+            while (error >= tol)
+            {
+                const Interval worst = heap.front();
+                const double m = (worst.a + worst.b) / 2;
+                if (used + 4 > maxEvaluations || !(worst.a < (worst.a + m) / 2 && (m + worst.b) / 2 < worst.b))
+                {
+                    // out of budget, or the worst interval cannot be split in floating point
+                    converged = false;
+                    break;
+                }
+                std::pop_heap(heap.begin(), heap.end(), less);
+                heap.pop_back();
+                const double q1 = (worst.a + m) / 2;
+                const double q3 = (m + worst.b) / 2;
+                const double f1 = f((worst.a + q1) / 2);
+                const double f2 = f((q1 + m) / 2);
+                const double f3 = f((m + q3) / 2);
+                const double f4 = f((q3 + worst.b) / 2);
+                *counter += 4;
+                used += 4;
+                const Interval left = interval(worst.a, m, worst.fa, f1, worst.fl, f2, worst.fm);
+                const Interval right = interval(m, worst.b, worst.fm, f3, worst.fr, f4, worst.fb);
+                heap.push_back(left);
+                std::push_heap(heap.begin(), heap.end(), less);
+                heap.push_back(right);
+                std::push_heap(heap.begin(), heap.end(), less);
+                error += left.error + right.error - worst.error;
+                if (error < tol)
+                {
+                    // the running total may have drifted by cancellation, confirm it before stopping
+                    error = 0.0;
+                    for (const Interval& i : heap)
+                    {
+                        error += i.error;
+                    }
+                }
+            }
+            // summed from left to right
+            std::sort(heap.begin(), heap.end(), [](const Interval& l, const Interval& r) { return l.a < r.a; });
+            Integral result{0.0, error, converged};
+            for (const Interval& i : heap)
+            {
+                result.value += i.value;
+            }
+            return result;
+        }
+
+        /**
+         * set tolerance
+         *
+         * @param tol: tolerance
+         */
+        GlobalASI setTol(const double tol)
+        {
+            this->tol = tol;
+            return *this;
+        }
+
+    private:
+        struct Interval
+        {
+            double a;
+            double b;
+            // f at a, the quarter points, the midpoint and b
+            double fa;
+            double fl;
+            double fm;
+            double fr;
+            double fb;
+            double value;
+            double error;
+        };
+
+        const F f;
+        const double a;
+        const double b;
+        double tol;
+        const int maxEvaluations;
+
+        static Interval interval(const double a, const double b, const double fa, const double fl, const double fm,
+                                 const double fr, const double fb)
+        {
+            const double mid = (a + b) / 2;
+            const double whole = 1.0 / 6 * (b - a) * (fa + 4 * fm + fb);
+            const double i_2 = 1.0 / 6 * (mid - a) * (fa + 4 * fl + fm) + 1.0 / 6 * (b - mid) * (fm + 4 * fr + fb);
+            return Interval{a, b, fa, fl, fm, fr, fb, i_2, std::abs(whole - i_2) / 15};
+        }
+
+        void checkTol() const
+        {
+            if (tol <= 0)
+            {
+                throw std::invalid_argument("Tolerance must be positive.");
+            }
+            if (maxEvaluations < 5)
+            {
+                throw std::invalid_argument("The budget must allow one step.");
+            }
+        }
+    };
+
+    /**
+     * make an ASI that inlines its integrand
+     *
+     * @param f: function to integrate
+     * @param a: lower bound
+     * @param b: upper bound
+     * @param tol: tolerance
+     * @return integrator storing a copy of f
+     */
+    template <typename F>
+    ASI<std::decay_t<F>> make_asi(F&& f, const double a, const double b, const double tol)
+    {
+        return ASI<std::decay_t<F>>(std::forward<F>(f), a, b, tol);
+    }
 } // asi
 
-#endif //ASI_H
 
 UTEST(ASI, TEST_1)
 {
@@ -125,3 +681,96 @@ UTEST(ASI, TEST_TOL)
     }
     EXPECT_TRUE(thrown);
 }
+
+UTEST(IterativeASI, Test)
+{
+    const std::function f = [](const double x) { return x + cos(pow(x, 5)); };
+    int expectedCounter = 0;
+    const double expected = alg::ASI(f, 0, M_PI, 1e-6).integrate(&expectedCounter);
+    int counter = 0;
+    const alg::Integral integral = alg::IterativeASI(f, 0, M_PI, 1e-6).integrateWithError(&counter);
+    EXPECT_TRUE(integral.converged);
+    EXPECT_EQ(counter, expectedCounter);
+    EXPECT_NEAR(integral.value, expected, 1e-12);
+    // a budget of 20 intervals stops early with a partial result
+    counter = 0;
+    const alg::Integral partial = alg::IterativeASI(f, 0, M_PI, 1e-6, 50, 180).integrateWithError(&counter);
+    EXPECT_FALSE(partial.converged);
+    EXPECT_LE(counter, 180);
+    EXPECT_GT(partial.error, 0.0);
+    EXPECT_TRUE(std::isfinite(partial.value));
+}
+
+UTEST(ReuseASI, Test)
+{
+    const std::function f = [](const double x) { return x + cos(pow(x, 5)); };
+    for (const double tol : {1e-2, 1e-4, 1e-6})
+    {
+        int expectedCounter = 0;
+        const double expected = alg::ASI(f, 0, M_PI, tol).integrate(&expectedCounter);
+        int counter = 0;
+        EXPECT_EQ(alg::ReuseASI(f, 0, M_PI, tol).integrate(&counter), expected);
+        // 3 evaluations up front and 2 per level, against 9 per level
+        EXPECT_EQ(expectedCounter, 9 * (counter - 3) / 2);
+    }
+}
+
+UTEST(ASI, TEST_INLINE)
+{
+    const auto g = [](const double x) { return x + cos(pow(x, 5)); };
+    const std::function<double(double)> f = g;
+    // a lambda is deduced as its own type, std::function stays the erased default
+    const alg::ASI inlined(g, 0, M_PI, 1e-6);
+    const alg::ASI<> erased(g, 0, M_PI, 1e-6);
+    static_assert(std::is_same_v<std::decay_t<decltype(inlined)>, alg::ASI<std::decay_t<decltype(g)>>>);
+    static_assert(std::is_same_v<std::decay_t<decltype(alg::ASI(f, 0, 1, 1))>, alg::ASI<>>);
+    int counter = 0;
+    int erasedCounter = 0;
+    EXPECT_EQ(inlined.integrate(&counter), erased.integrate(&erasedCounter));
+    EXPECT_EQ(counter, erasedCounter);
+    EXPECT_EQ(alg::make_asi(g, 0, M_PI, 1e-6).integrate(), inlined.integrate());
+}
+
+UTEST(ASI, TEST_BATCH)
+{
+    const std::function f = [](const double x) { return x + cos(pow(x, 5)); };
+    int calls = 0;
+    const auto batch = [&calls](const double* x, double* y, const size_t n)
+    {
+        ++calls;
+        for (size_t i = 0; i < n; ++i)
+        {
+            y[i] = x[i] + cos(pow(x[i], 5));
+        }
+    };
+    int expectedCounter = 0;
+    const double expected = alg::ASI(f, 0, M_PI, 1e-6).integrate(&expectedCounter);
+    int counter = 0;
+    EXPECT_EQ(alg::ASI(batch, 0, M_PI, 1e-6).integrate(&counter), expected);
+    // every point once, as in ReuseASI, in one call per level of the refinement
+    EXPECT_EQ(expectedCounter, 9 * (counter - 3) / 2);
+    EXPECT_LT(calls, 40);
+}
+
+UTEST(GlobalASI, Test)
+{
+    const std::function f = [](const double x) { return x + cos(pow(x, 5)); };
+    const double exact = alg::ReuseASI(f, 0, M_PI, 1e-13).integrate();
+    for (const double tol : {1e-4, 1e-6, 1e-8})
+    {
+        int localCounter = 0;
+        const double local = alg::ReuseASI(f, 0, M_PI, tol).integrate(&localCounter);
+        int counter = 0;
+        const alg::Integral global = alg::GlobalASI(f, 0, M_PI, tol).integrateWithError(&counter);
+        EXPECT_TRUE(global.converged);
+        EXPECT_LT(global.error, tol);
+        EXPECT_LT(std::abs(global.value - exact), 10 * tol);
+        EXPECT_LT(counter, localCounter);
+        EXPECT_LT(std::abs(local - exact), 10 * tol);
+    }
+    int counter = 0;
+    EXPECT_FALSE(alg::GlobalASI(f, 0, M_PI, 1e-10, 101).integrateWithError(&counter).converged);
+    EXPECT_LE(counter, 101);
+}
+
+#endif //ASI_H
@@ -0,0 +1,303 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef ASI_2D_H
+#define ASI_2D_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Adaptive mesh of a 2D cubature, a quadtree of cells with the same split geometry as QuadTree
+     */
+    struct CubatureMesh
+    {
+        struct Cell
+        {
+            Rectangle rect;
+            // integral over the cell, from its refined rule
+            double value;
+            // difference between the coarse and the refined rule
+            double error;
+            // top left, top right, bottom left, bottom right, -1 for a leaf
+            int children[4];
+        };
+
+        // cells[0] is the whole domain, children always follow their parent
+        std::vector<Cell> cells{};
+        double value = 0.0;
+
+        /**
+         * integrate another function on the leaves of the mesh without refining it
+         *
+         * @param g: function to integrate
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(const std::function<double(double, double)>& g, int* counter) const
+        {
+            double sum = 0.0;
+            for (const Cell& cell : cells)
+            {
+                if (cell.children[0] >= 0)
+                {
+                    continue;
+                }
+                const Rectangle& r = cell.rect;
+                const double xs[3] = {r.bottomLeft.x, (r.bottomLeft.x + r.topRight.x) / 2, r.topRight.x};
+                const double ys[3] = {r.bottomLeft.y, (r.bottomLeft.y + r.topRight.y) / 2, r.topRight.y};
+                double s = 0.0;
+                for (int i = 0; i < 3; ++i)
+                {
+                    for (int j = 0; j < 3; ++j)
+                    {
+                        s += WEIGHTS[i] * WEIGHTS[j] * g(xs[i], ys[j]);
+                    }
+                }
+                *counter += 9;
+                sum += s * (r.topRight.x - r.bottomLeft.x) * (r.topRight.y - r.bottomLeft.y) / 36;
+            }
+            return sum;
+        }
+
+        [[nodiscard]] size_t leaves() const
+        {
+            size_t n = 0;
+            for (const Cell& cell : cells)
+            {
+                n += cell.children[0] < 0;
+            }
+            return n;
+        }
+
+        static constexpr double WEIGHTS[3] = {1, 4, 1};
+    };
+
+    /**
+     * Adaptive Simpson's Rule over a rectangle.
+     *
+     * Every cell is integrated with the tensor product Simpson rule on its 3 x 3 grid and on the 5 x 5 grid of its four
+     * quadrants. If the two differ by 15 times the tolerance or more, the cell is split like QuadTree::divide() and every
+     * quadrant gets a quarter of the tolerance. Grid points lie on a dyadic lattice of the domain and their values are
+     * cached, so corners and edges shared between a cell and its neighbours or its parent are evaluated once. A split
+     * costs 16 new evaluations instead of the 25 of two nested one dimensional rules.
+     */
+    class ASI2D
+    {
+    public:
+        /**
+         * Constructor of the 2D Adaptive Simpson's Rule. After construction, call `integrate()` to get the integrated
+         * value.
+         *
+         * @param f: function to integrate
+         * @param domain: rectangle to integrate over
+         * @param tol: tolerance
+         */
+        ASI2D(const std::function<double(double, double)>& f, const Rectangle domain, const double tol) : f(f),
+            domain(domain), tol(tol)
+        {
+        }
+
+        /**
+         * integrate function f over the domain
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(int* counter) const
+        {
+            return refine(counter).value;
+        }
+
+        /**
+         * integrate function f over the domain
+         *
+         * @return integrated value
+         */
+        double integrate() const
+        {
+            int _ = 0;
+            return integrate(&_);
+        }
+
+        /**
+         * integrate function f over the domain and keep the adaptive mesh
+         *
+         * @param counter: counter for number of function evaluations
+         * @return mesh with the integrated value
+         */
+        CubatureMesh refine(int* counter) const
+        {
+            checkTol();
+            Refinement refinement{CubatureMesh{}, {}, counter};
+            refinement.mesh.cells.push_back(CubatureMesh::Cell{domain, 0.0, 0.0, {-1, -1, -1, -1}});
+            refinement.mesh.value = call(refinement, 0, 0, 0, 0, tol);
+            return std::move(refinement.mesh);
+        }
+
+        /**
+         * set tolerance
+         *
+         * @param tol: tolerance
+         */
+        ASI2D setTol(const double tol)
+        {
+            this->tol = tol;
+            return *this;
+        }
+
+    private:
+        // cells deeper than this are not split, which bounds the work for singular integrands
+        static constexpr int MAX_DEPTH = 20;
+        // the lattice is fine enough for the 5 x 5 grid of the deepest cells
+        static constexpr int LATTICE = MAX_DEPTH + 2;
+
+        struct Refinement
+        {
+            CubatureMesh mesh;
+            // values on the lattice, keyed by (i << 32) | j
+            std::unordered_map<uint64_t, double> values;
+            int* counter;
+        };
+
+        const std::function<double(double, double)> f;
+        const Rectangle domain;
+        double tol;
+
+        double value(Refinement& refinement, const uint64_t i, const uint64_t j) const
+        {
+            const uint64_t key = (i << 32) | j;
+            const auto found = refinement.values.find(key);
+            if (found != refinement.values.end())
+            {
+                return found->second;
+            }
+            constexpr double scale = 1.0 / static_cast<double>(uint64_t{1} << LATTICE);
+            const double x = domain.bottomLeft.x + (domain.topRight.x - domain.bottomLeft.x) * (i * scale);
+            const double y = domain.bottomLeft.y + (domain.topRight.y - domain.bottomLeft.y) * (j * scale);
+            const double v = f(x, y);
+            ++*refinement.counter;
+            refinement.values.emplace(key, v);
+            return v;
+        }
+
+        /**
+         * @param index: cell in the mesh
+         * @param depth: depth of the cell
+         * @param i: lattice column of the bottom left corner
+         * @param j: lattice row of the bottom left corner
+         * @param tol: tolerance of the cell
+         */
+        double call(Refinement& refinement, const int index, const int depth, const uint64_t i, const uint64_t j,
+                    const double tol) const
+        {
+            const uint64_t step = uint64_t{1} << (LATTICE - depth - 2);
+            double grid[5][5];
+            for (uint64_t u = 0; u < 5; ++u)
+            {
+                for (uint64_t v = 0; v < 5; ++v)
+                {
+                    // the coarse rule only needs the even points, the fine rule all of them
+                    grid[u][v] = value(refinement, i + u * step, j + v * step);
+                }
+            }
+            const Rectangle rect = refinement.mesh.cells[index].rect;
+            const double area = (rect.topRight.x - rect.bottomLeft.x) * (rect.topRight.y - rect.bottomLeft.y);
+            const double i_1 = simpson(grid, 0, 0, 2) * area / 36;
+            const double i_2 = (simpson(grid, 0, 0, 1) + simpson(grid, 2, 0, 1) + simpson(grid, 0, 2, 1) +
+                simpson(grid, 2, 2, 1)) * area / 144;
+            refinement.mesh.cells[index].value = i_2;
+            refinement.mesh.cells[index].error = std::abs(i_1 - i_2);
+            if (std::abs(i_1 - i_2) < 15 * tol || depth >= MAX_DEPTH)
+            {
+                return i_2;
+            }
+            const double x_mid = (rect.bottomLeft.x + rect.topRight.x) / 2.0;
+            const double y_mid = (rect.bottomLeft.y + rect.topRight.y) / 2.0;
+            const Rectangle rects[4] = {
+                Rectangle(Point(rect.bottomLeft.x, y_mid), Point(x_mid, rect.topRight.y)),
+                Rectangle(Point(x_mid, y_mid), rect.topRight),
+                Rectangle(rect.bottomLeft, Point(x_mid, y_mid)),
+                Rectangle(Point(x_mid, rect.bottomLeft.y), Point(rect.topRight.x, y_mid))
+            };
+            const uint64_t half = 2 * step;
+            const uint64_t corners[4][2] = {{i, j + half}, {i + half, j + half}, {i, j}, {i + half, j}};
+            const int first = static_cast<int>(refinement.mesh.cells.size());
+            for (int c = 0; c < 4; ++c)
+            {
+                refinement.mesh.cells[index].children[c] = first + c;
+                refinement.mesh.cells.push_back(CubatureMesh::Cell{rects[c], 0.0, 0.0, {-1, -1, -1, -1}});
+            }
+            double sum = 0.0;
+            for (int c = 0; c < 4; ++c)
+            {
+                sum += call(refinement, first + c, depth + 1, corners[c][0], corners[c][1], tol / 4);
+            }
+            refinement.mesh.cells[index].value = sum;
+            return sum;
+        }
+
+        /**
+         * unscaled tensor product Simpson sum over grid[u + s * (0..2)][v + s * (0..2)]
+         */
+        static double simpson(const double (&grid)[5][5], const int u, const int v, const int s)
+        {
+            double sum = 0.0;
+            for (int a = 0; a < 3; ++a)
+            {
+                for (int b = 0; b < 3; ++b)
+                {
+                    sum += CubatureMesh::WEIGHTS[a] * CubatureMesh::WEIGHTS[b] * grid[u + s * a][v + s * b];
+                }
+            }
+            return sum;
+        }
+
+        void checkTol() const
+        {
+            if (tol <= 0)
+            {
+                throw std::invalid_argument("Tolerance must be positive.");
+            }
+        }
+    };
+}
+
+UTEST(ASI2D, Test)
+{
+    const std::function f = [](const double x, const double y) { return x * y; };
+    const alg::ASI2D asi(f, alg::Rectangle{alg::Point{0.0, 0.0}, alg::Point{1.0, 1.0}}, 1e-6);
+    EXPECT_NEAR(asi.integrate(), 0.25, 1e-12);
+}
+
+UTEST(ASI2D, Gaussian)
+{
+    const std::function f = [](const double x, const double y) { return std::exp(-(x * x + y * y)); };
+    const alg::Rectangle domain{alg::Point{-2.0, -2.0}, alg::Point{2.0, 2.0}};
+    const alg::ASI2D asi(f, domain, 1e-7);
+    int counter = 0;
+    const alg::CubatureMesh mesh = asi.refine(&counter);
+    const double exact = M_PI * std::erf(2.0) * std::erf(2.0);
+    EXPECT_NEAR(mesh.value, exact, 1e-6);
+    EXPECT_GT(mesh.leaves(), 1u);
+    // every leaf has a 5 x 5 grid, but shared points are evaluated once
+    EXPECT_LT(static_cast<size_t>(counter), 25 * mesh.leaves());
+    // the mesh is reused for another integrand
+    int reused = 0;
+    const std::function one = [](double, double) { return 1.0; };
+    EXPECT_NEAR(mesh.integrate(one, &reused), 16.0, 1e-12);
+    EXPECT_EQ(static_cast<size_t>(reused), 9 * mesh.leaves());
+}
+
+#endif //ASI_2D_H
@@ -5,9 +5,15 @@
 #ifndef TREE_H
 #define TREE_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <thread>
 #include <vector>
-#include <tuple>
 
+#include "parallel.h"
 #include "utilities/utest.h"
 #include "utilities/mpl_writer.hpp"
 #include "utilities/random_points.hpp"
@@ -44,6 +50,92 @@ namespace alg
         Point topRight;
     };
 
+    /**
+     * Query probe that records nothing. Its calls compile away, so an uninstrumented query costs nothing extra.
+     */
+    struct NullProbe
+    {
+        void visit()
+        {
+        }
+
+        void prune()
+        {
+        }
+
+        void accept(size_t)
+        {
+        }
+
+        void test(size_t)
+        {
+        }
+
+        void hit(size_t)
+        {
+        }
+    };
+
+    /**
+     * Query probe counting the work of one query
+     */
+    struct QueryCounters
+    {
+        // nodes whose rectangle was tested
+        size_t nodesVisited = 0;
+        // nodes inside the query, copied without testing their points
+        size_t nodesAccepted = 0;
+        // points copied from accepted nodes
+        size_t pointsAccepted = 0;
+        // nodes outside the query
+        size_t nodesPruned = 0;
+        // leaf points tested against the query
+        size_t pointsTested = 0;
+        size_t hits = 0;
+        size_t bytesAppended = 0;
+
+        void visit()
+        {
+            ++nodesVisited;
+        }
+
+        void prune()
+        {
+            ++nodesPruned;
+        }
+
+        void accept(const size_t n)
+        {
+            ++nodesAccepted;
+            pointsAccepted += n;
+            hit(n);
+        }
+
+        void test(const size_t n)
+        {
+            pointsTested += n;
+        }
+
+        void hit(const size_t n)
+        {
+            hits += n;
+            bytesAppended += n * sizeof(Point);
+        }
+    };
+
+    /**
+     * Result of a sampled range query
+     */
+    struct SampledResult
+    {
+        // at most `maxPoints` representative points inside the query rectangle
+        std::vector<Point> points;
+        // estimated number of points inside the query rectangle
+        double count;
+        // half width of the confidence interval of `count`
+        double error;
+    };
+
     class QuadTree
     {
     public:
@@ -53,17 +145,26 @@ namespace alg
         std::unique_ptr<QuadTree> topRight;
         std::unique_ptr<QuadTree> bottomLeft;
         std::unique_ptr<QuadTree> bottomRight;
+        // reservoir sample of `points`, at most SAMPLE_SIZE points
+        std::vector<Point> sample;
         int capacity;
         bool isLeaf;
+        // depth of the node, the root is on depth 0
+        int depth = 0;
 
-        QuadTree(std::vector<Point>& points, int capacity, Rectangle rect) : points(points), capacity(capacity),
-                                                                             rect(rect)
+        static constexpr size_t SAMPLE_SIZE = 16;
+        // nodes this deep are not split and grow past `capacity`, which bounds the depth for repeated points
+        static constexpr int MAX_DEPTH = 32;
+
+        QuadTree(std::vector<Point>& points, int capacity, Rectangle rect, int depth = 0) : points(points),
+            capacity(capacity), rect(rect), depth(depth)
         {
             isLeaf = true;
             topLeft = std::nullptr_t();
             topRight = std::nullptr_t();
             bottomLeft = std::nullptr_t();
             bottomRight = std::nullptr_t();
+            this->build_sample();
             this->divide();
         }
 
@@ -87,11 +188,12 @@ namespace alg
             topRight = std::nullptr_t();
             bottomLeft = std::nullptr_t();
             bottomRight = std::nullptr_t();
+            this->build_sample();
             this->divide();
         }
 
-        QuadTree(const QuadTree& other) : rect(other.rect), points(other.points), capacity(other.capacity),
-                                          isLeaf(other.isLeaf)
+        QuadTree(const QuadTree& other) : rect(other.rect), points(other.points), sample(other.sample),
+                                          capacity(other.capacity), isLeaf(other.isLeaf), depth(other.depth)
         {
             if (other.topLeft) topLeft = std::make_unique<QuadTree>(*other.topLeft);
             if (other.topRight) topRight = std::make_unique<QuadTree>(*other.topRight);
@@ -101,21 +203,38 @@ namespace alg
 
         void query(Rectangle rect, std::vector<Point>& result)
         {
+            NullProbe probe;
+            query(rect, result, probe);
+        }
+
+        /**
+         * query the points inside a rectangle and report the work done to a probe
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         * @param probe: receives visit(), prune(), accept(n), test(n) and hit(n) while the tree is traversed
+         */
+        template <typename Probe>
+        void query(Rectangle rect, std::vector<Point>& result, Probe& probe)
+        {
+            probe.visit();
             if (!check_intersect(rect))
             {
+                probe.prune();
                 return;
             }
             if (check_include(rect))
             {
+                probe.accept(points.size());
                 result.insert(result.end(), points.begin(), points.end());
                 return;
             }
             if (!isLeaf)
             {
-                topLeft->query(rect, result);
-                topRight->query(rect, result);
-                bottomLeft->query(rect, result);
-                bottomRight->query(rect, result);
+                topLeft->query(rect, result, probe);
+                topRight->query(rect, result, probe);
+                bottomLeft->query(rect, result, probe);
+                bottomRight->query(rect, result, probe);
             }
             else
             {
@@ -123,6 +242,7 @@ namespace alg
                 const double x_max = rect.topRight.x;
                 const double y_min = rect.bottomLeft.y;
                 const double y_max = rect.topRight.y;
+                const size_t before = result.size();
                 for (Point point : points)
                 {
                     if (point.x >= x_min && point.x <= x_max && point.y >= y_min && point.y <= y_max)
@@ -130,6 +250,82 @@ namespace alg
                         result.push_back(point);
                     }
                 }
+                probe.test(points.size());
+                probe.hit(result.size() - before);
+            }
+        }
+
+        /**
+         * approximate range query. Nodes inside the rectangle contribute their exact count, leaves crossing its border
+         * are estimated from their reservoir sample, so the cost is bounded by the number of nodes rather than hits.
+         *
+         * @param rect: query rectangle
+         * @param maxPoints: maximum number of representative points to return
+         * @param z: z-score of the confidence bound, 1.96 for 95%
+         * @return representative points, estimated count and its error bound
+         */
+        [[nodiscard]] SampledResult querySampled(const Rectangle rect, const size_t maxPoints,
+                                                 const double z = 1.96) const
+        {
+            std::vector<std::pair<Point, double>> candidates{};
+            double count = 0.0;
+            double variance = 0.0;
+            collect_sampled(rect, candidates, count, variance);
+            SampledResult result{{}, count, z * std::sqrt(variance)};
+            if (candidates.size() <= maxPoints)
+            {
+                for (const auto& candidate : candidates)
+                {
+                    result.points.push_back(candidate.first);
+                }
+                return result;
+            }
+            // weighted sampling without replacement: keep the largest u^(1/w)
+            std::mt19937_64 rng(candidates.size());
+            std::uniform_real_distribution<> uniform(0.0, 1.0);
+            std::vector<std::pair<double, size_t>> keys(candidates.size());
+            for (size_t i = 0; i < candidates.size(); ++i)
+            {
+                keys[i] = {std::pow(uniform(rng), 1.0 / candidates[i].second), i};
+            }
+            std::nth_element(keys.begin(), keys.begin() + static_cast<long>(maxPoints), keys.end(),
+                             [](const auto& l, const auto& r) { return l.first > r.first; });
+            for (size_t i = 0; i < maxPoints; ++i)
+            {
+                result.points.push_back(candidates[keys[i].second].first);
+            }
+            return result;
+        }
+
+        /**
+         * insert a point into the tree, splitting the leaf it lands in once it exceeds `capacity`
+         *
+         * @param point: point to insert
+         * @return false if the point lies outside the rectangle of the tree
+         */
+        bool insert(Point point)
+        {
+            if (!check_contain(point))
+            {
+                return false;
+            }
+            points.push_back(point);
+            sample_point(points.size() - 1);
+            if (isLeaf)
+            {
+                divide();
+                return true;
+            }
+            switch (quadrant_of(point))
+            {
+            case 0:
+                return topLeft->insert(point);
+            case 1:
+                return topRight->insert(point);
+            case 2:
+                return bottomLeft->insert(point);
+            default:
+                return bottomRight->insert(point);
             }
         }
 
@@ -141,7 +337,7 @@ namespace alg
             double y_min = rect.bottomLeft.y;
             double y_max = rect.topRight.y;
             // check if the node is a leaf
-            if (points.size() > capacity)
+            if (points.size() > capacity && depth < MAX_DEPTH)
             {
                 isLeaf = false;
                 // divide the points into four quadrants
@@ -164,30 +360,126 @@ namespace alg
                 std::vector<Point> bottomRightPoints{};
                 for (Point point : points)
                 {
-                    if (point.x >= x_min && point.x <= x_mid && point.y >= y_mid && point.y <= y_max)
+                    switch (quadrant_of(point))
                     {
+                    case 0:
                         topLeftPoints.push_back(point);
-                    }
-                    else if (point.x >= x_mid && point.x <= x_max && point.y >= y_mid && point.y <= y_max)
-                    {
+                        break;
+                    case 1:
                         topRightPoints.push_back(point);
-                    }
-                    else if (point.x >= x_min && point.x <= x_mid && point.y >= y_min && point.y <= y_mid)
-                    {
+                        break;
+                    case 2:
                         bottomLeftPoints.push_back(point);
-                    }
-                    else
-                    {
+                        break;
+                    default:
                         bottomRightPoints.push_back(point);
                     }
                 }
-                topLeft = std::make_unique<QuadTree>(topLeftPoints, capacity, topLeftR);
-                topRight = std::make_unique<QuadTree>(topRightPoints, capacity, topRightR);
-                bottomLeft = std::make_unique<QuadTree>(bottomLeftPoints, capacity, bottomLeftR);
-                bottomRight = std::make_unique<QuadTree>(bottomRightPoints, capacity, bottomRightR);
+                topLeft = std::make_unique<QuadTree>(topLeftPoints, capacity, topLeftR, depth + 1);
+                topRight = std::make_unique<QuadTree>(topRightPoints, capacity, topRightR, depth + 1);
+                bottomLeft = std::make_unique<QuadTree>(bottomLeftPoints, capacity, bottomLeftR, depth + 1);
+                bottomRight = std::make_unique<QuadTree>(bottomRightPoints, capacity, bottomRightR, depth + 1);
+            }
+        }
+
+        void build_sample()
+        {
+            sample.clear();
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                sample_point(i);
+            }
+        }
+
+        /**
+         * reservoir step for `points[i]`. The replacement slot is hashed from `i` so that samples are reproducible.
+         */
+        void sample_point(const size_t i)
+        {
+            if (sample.size() < SAMPLE_SIZE)
+            {
+                sample.push_back(points[i]);
+                return;
+            }
+            uint64_t h = i + 0x9e3779b97f4a7c15ULL;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+            const size_t j = h % (i + 1);
+            if (j < SAMPLE_SIZE)
+            {
+                sample[j] = points[i];
+            }
+        }
+
+        void collect_sampled(const Rectangle rect, std::vector<std::pair<Point, double>>& candidates, double& count,
+                             double& variance) const
+        {
+            if (!check_intersect(rect) || points.empty())
+            {
+                return;
+            }
+            const double n = static_cast<double>(points.size());
+            const double k = static_cast<double>(sample.size());
+            if (check_include(rect))
+            {
+                count += n;
+                for (Point point : sample)
+                {
+                    candidates.emplace_back(point, n / k);
+                }
+                return;
+            }
+            if (!isLeaf)
+            {
+                topLeft->collect_sampled(rect, candidates, count, variance);
+                topRight->collect_sampled(rect, candidates, count, variance);
+                bottomLeft->collect_sampled(rect, candidates, count, variance);
+                bottomRight->collect_sampled(rect, candidates, count, variance);
+                return;
+            }
+            double hits = 0.0;
+            for (Point point : sample)
+            {
+                if (point.x >= rect.bottomLeft.x && point.x <= rect.topRight.x && point.y >= rect.bottomLeft.y &&
+                    point.y <= rect.topRight.y)
+                {
+                    candidates.emplace_back(point, n / k);
+                    hits += 1.0;
+                }
+            }
+            count += n * hits / k;
+            if (sample.size() < points.size())
+            {
+                // binomial variance with finite population correction, p smoothed away from 0 and 1
+                const double p = (hits + 0.5) / (k + 1.0);
+                variance += n * n * p * (1.0 - p) / k * (n - k) / (n - 1.0);
             }
         }
 
+        /**
+         * index of the child a point belongs to: 0 top left, 1 top right, 2 bottom left, 3 bottom right
+         */
+        [[nodiscard]] int quadrant_of(Point point) const
+        {
+            const double x_min = rect.bottomLeft.x;
+            const double x_max = rect.topRight.x;
+            const double y_min = rect.bottomLeft.y;
+            const double y_max = rect.topRight.y;
+            const double x_mid = (x_min + x_max) / 2.0;
+            const double y_mid = (y_min + y_max) / 2.0;
+            if (point.x >= x_min && point.x <= x_mid && point.y >= y_mid && point.y <= y_max) return 0;
+            if (point.x >= x_mid && point.x <= x_max && point.y >= y_mid && point.y <= y_max) return 1;
+            if (point.x >= x_min && point.x <= x_mid && point.y >= y_min && point.y <= y_mid) return 2;
+            return 3;
+        }
+
+        [[nodiscard]] bool check_contain(Point point) const
+        {
+            return point.x >= rect.bottomLeft.x && point.x <= rect.topRight.x &&
+                point.y >= rect.bottomLeft.y && point.y <= rect.topRight.y;
+        }
+
         [[nodiscard]] bool check_intersect(Rectangle rect) const
         {
             return !(rect.topRight.x < this->rect.bottomLeft.x || rect.bottomLeft.x > this->rect.topRight.x ||
@@ -201,6 +493,126 @@ namespace alg
         }
     };
 
+    /**
+     * Read-only view of a contiguous run of points
+     */
+    class PointSpan
+    {
+    public:
+        PointSpan(const Point* data, const size_t size) : data(data), count(size)
+        {
+        }
+
+        [[nodiscard]] const Point* begin() const
+        {
+            return data;
+        }
+
+        [[nodiscard]] const Point* end() const
+        {
+            return data + count;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return count;
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            return count == 0;
+        }
+
+        const Point& operator[](const size_t i) const
+        {
+            return data[i];
+        }
+
+    private:
+        const Point* data;
+        size_t count;
+    };
+
+    /**
+     * Rectangle of a partition and the points inside it
+     */
+    struct CellView
+    {
+        Rectangle rect;
+        PointSpan points;
+    };
+
+    /**
+     * Read-only view of the cells of a partition. Each cell is a rectangle plus a run of the permuted point array, so
+     * iterating the cells does not allocate.
+     */
+    class CellRange
+    {
+    public:
+        struct Cell
+        {
+            Rectangle rect;
+            size_t offset;
+            size_t count;
+        };
+
+        class Iterator
+        {
+        public:
+            Iterator(const Cell* cell, const Point* points) : cell(cell), points(points)
+            {
+            }
+
+            CellView operator*() const
+            {
+                return CellView{cell->rect, PointSpan(points + cell->offset, cell->count)};
+            }
+
+            Iterator& operator++()
+            {
+                ++cell;
+                return *this;
+            }
+
+            bool operator!=(const Iterator& other) const
+            {
+                return cell != other.cell;
+            }
+
+        private:
+            const Cell* cell;
+            const Point* points;
+        };
+
+        CellRange(const std::vector<Cell>& cells, const std::vector<Point>& points) : cells(cells), points(points)
+        {
+        }
+
+        [[nodiscard]] Iterator begin() const
+        {
+            return Iterator(cells.data(), points.data());
+        }
+
+        [[nodiscard]] Iterator end() const
+        {
+            return Iterator(cells.data() + cells.size(), points.data());
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return cells.size();
+        }
+
+        CellView operator[](const size_t i) const
+        {
+            return CellView{cells[i].rect, PointSpan(points.data() + cells[i].offset, cells[i].count)};
+        }
+
+    private:
+        const std::vector<Cell>& cells;
+        const std::vector<Point>& points;
+    };
+
     class DirectSearch
     {
     public:
@@ -209,12 +621,24 @@ namespace alg
         }
 
         std::vector<Point> query(Rectangle rect)
+        {
+            std::vector<Point> result{};
+            query(rect, result);
+            return result;
+        }
+
+        /**
+         * query the points inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(Rectangle rect, std::vector<Point>& result) const
         {
             double x_min = rect.bottomLeft.x;
             double x_max = rect.topRight.x;
             double y_min = rect.bottomLeft.y;
             double y_max = rect.topRight.y;
-            std::vector<Point> result{};
             for (Point point : points)
             {
                 if (point.x >= x_min && point.x <= x_max && point.y >= y_min && point.y <= y_max)
@@ -222,10 +646,18 @@ namespace alg
                     result.push_back(point);
                 }
             }
-            return result;
         }
 
-        void divide(int capacity)
+        /**
+         * partition the points into rectangles holding at most `capacity` points each. Points are filtered once per
+         * level and handed down to the sub-rectangles instead of rescanning every point for every rectangle. A point
+         * on a shared border belongs to every rectangle that contains it, like in `query()`. Like in QuadTree,
+         * rectangles on QuadTree::MAX_DEPTH are not split further and may hold more points.
+         *
+         * @param capacity: maximum number of points per rectangle
+         * @param parallel: partition the top levels on separate threads
+         */
+        void divide(int capacity, bool parallel = false)
         {
             // calculate the bounding box of the points
             double x_min = points[0].x;
@@ -240,63 +672,534 @@ namespace alg
                 y_max = std::max(y_max, point.y);
             }
             Rectangle rect = Rectangle(Point(x_min, y_min), Point(x_max, y_max));
-            std::vector<Rectangle> result{};
-            std::vector<Rectangle> queue{};
-            queue.push_back(rect);
-            while (!queue.empty())
-            {
-                Rectangle current = queue.back();
-                queue.pop_back();
-                std::vector<Point> pointsInRect = query(current);
-                if (pointsInRect.size() > capacity)
+            // every spawning call runs one quadrant itself and starts a thread for each of the other three, so spawning on
+            // three levels starts 3 + 12 + 48 threads and runs the 64 rectangles of depth 3 at once
+            partition(rect, points, capacity, 0, parallel ? 3 : 0, result);
+        }
+
+        /**
+         * cells of the partition. The view is invalidated by the next call to `divide()`.
+         *
+         * @return range of (rectangle, points) views
+         */
+        [[nodiscard]] CellRange getResult() const
+        {
+            return CellRange(result.cells, result.points);
+        }
+
+    private:
+        struct Partition
+        {
+            // points of all cells, cell by cell
+            std::vector<Point> points;
+            std::vector<CellRange::Cell> cells;
+        };
+
+        std::vector<Point> points{};
+        Partition result{};
+
+        /**
+         * split a rectangle until it holds at most `capacity` points. Sub-rectangles are visited bottom right, top
+         * left, top right, bottom left, the order in which the former work queue popped them.
+         */
+        static void partition(const Rectangle current, const std::vector<Point>& pointsInRect, const int capacity,
+                              const int depth, const int spawnDepth, Partition& out)
+        {
+            if (pointsInRect.size() <= static_cast<size_t>(capacity) || depth >= QuadTree::MAX_DEPTH)
+            {
+                out.cells.push_back(CellRange::Cell{current, out.points.size(), pointsInRect.size()});
+                out.points.insert(out.points.end(), pointsInRect.begin(), pointsInRect.end());
+                return;
+            }
+            // divide the rectangle into four sub-rectangles
+            double x_mid = (current.bottomLeft.x + current.topRight.x) / 2.0;
+            double y_mid = (current.bottomLeft.y + current.topRight.y) / 2.0;
+            Point p1(current.bottomLeft.x, current.bottomLeft.y);
+            Point p2(x_mid, y_mid);
+            Point p3(x_mid, current.topRight.y);
+            Point p4(current.bottomLeft.x, y_mid);
+            Point p5(current.topRight.x, y_mid);
+            Point p6(current.topRight.x, current.topRight.y);
+            Point p7(x_mid, current.bottomLeft.y);
+            const Rectangle children[4] = {Rectangle(p7, p5), Rectangle(p4, p3), Rectangle(p2, p6), Rectangle(p1, p2)};
+            std::vector<Point> subsets[4];
+            for (Point point : pointsInRect)
+            {
+                for (int i = 0; i < 4; ++i)
+                {
+                    const Rectangle& r = children[i];
+                    if (point.x >= r.bottomLeft.x && point.x <= r.topRight.x && point.y >= r.bottomLeft.y &&
+                        point.y <= r.topRight.y)
+                    {
+                        subsets[i].push_back(point);
+                    }
+                }
+            }
+            if (spawnDepth <= 0)
+            {
+                for (int i = 0; i < 4; ++i)
+                {
+                    partition(children[i], subsets[i], capacity, depth + 1, 0, out);
+                    std::vector<Point>().swap(subsets[i]);
+                }
+                return;
+            }
+            Partition parts[4];
+            std::vector<std::thread> workers{};
+            for (int i = 1; i < 4; ++i)
+            {
+                workers.emplace_back([&, i] { partition(children[i], subsets[i], capacity, depth + 1, spawnDepth - 1, parts[i]); });
+            }
+            partition(children[0], subsets[0], capacity, depth + 1, spawnDepth - 1, parts[0]);
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+            for (const Partition& part : parts)
+            {
+                for (CellRange::Cell cell : part.cells)
+                {
+                    cell.offset += out.points.size();
+                    out.cells.push_back(cell);
+                }
+                out.points.insert(out.points.end(), part.points.begin(), part.points.end());
+            }
+        }
+    };
+
+    /**
+     * Brute force search over points stored as separate x and y arrays.
+     *
+     * The scan runs in blocks of BLOCK points: a branch free pass writes a hit mask the compiler can vectorize, a
+     * second pass compacts the hits. The point range is split over threads and the per-thread results are merged in
+     * order, so `query()` returns the same points in the same order as `DirectSearch::query()`.
+     */
+    class ParallelDirectSearch
+    {
+    public:
+        /**
+         * Constructor of the parallel direct search.
+         *
+         * @param points: points to search
+         * @param threads: number of threads, 0 for the hardware concurrency
+         */
+        explicit ParallelDirectSearch(const std::vector<Point>& points, const unsigned threads = 0) :
+            xs(points.size()), ys(points.size()), threads(threads)
+        {
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                xs[i] = points[i].x;
+                ys[i] = points[i].y;
+            }
+        }
+
+        std::vector<Point> query(const Rectangle rect) const
+        {
+            std::vector<Point> result{};
+            query(rect, result);
+            return result;
+        }
+
+        /**
+         * query the points inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result) const
+        {
+            std::vector<std::vector<Point>> parts(threadCount(threads));
+            const size_t chunks = parallelChunks(xs.size(), threads, GRAIN, [&](size_t t, size_t begin, size_t end)
+            {
+                uint8_t mask[BLOCK];
+                for (size_t i = begin; i < end; i += BLOCK)
+                {
+                    const size_t n = std::min(BLOCK, end - i);
+                    scan(rect, i, n, mask);
+                    compact(i, n, mask, parts[t]);
+                }
+            });
+            if (chunks == 1 && result.empty())
+            {
+                result.swap(parts[0]);
+                return;
+            }
+            for (size_t t = 0; t < chunks; ++t)
+            {
+                result.insert(result.end(), parts[t].begin(), parts[t].end());
+            }
+        }
+
+        /**
+         * count the points inside a rectangle without collecting them
+         *
+         * @param rect: query rectangle
+         * @return number of points inside the rectangle
+         */
+        [[nodiscard]] size_t count(const Rectangle rect) const
+        {
+            std::vector<size_t> parts(threadCount(threads));
+            const size_t chunks = parallelChunks(xs.size(), threads, GRAIN, [&](size_t t, size_t begin, size_t end)
+            {
+                uint8_t mask[BLOCK];
+                size_t hits = 0;
+                for (size_t i = begin; i < end; i += BLOCK)
+                {
+                    const size_t n = std::min(BLOCK, end - i);
+                    scan(rect, i, n, mask);
+                    hits += sum(n, mask);
+                }
+                parts[t] = hits;
+            });
+            size_t total = 0;
+            for (size_t t = 0; t < chunks; ++t)
+            {
+                total += parts[t];
+            }
+            return total;
+        }
+
+        /**
+         * answer several queries in one pass over the points. Each block of points is tested against every rectangle
+         * while it is still in cache.
+         *
+         * @param rects: query rectangles
+         * @return points inside each rectangle, in the order of `rects`
+         */
+        [[nodiscard]] std::vector<std::vector<Point>> queryBatch(const std::vector<Rectangle>& rects) const
+        {
+            std::vector<std::vector<std::vector<Point>>> parts(threadCount(threads),
+                                                               std::vector<std::vector<Point>>(rects.size()));
+            const size_t chunks = parallelChunks(xs.size(), threads, GRAIN, [&](size_t t, size_t begin, size_t end)
+            {
+                uint8_t mask[BLOCK];
+                for (size_t i = begin; i < end; i += BLOCK)
+                {
+                    const size_t n = std::min(BLOCK, end - i);
+                    for (size_t q = 0; q < rects.size(); ++q)
+                    {
+                        scan(rects[q], i, n, mask);
+                        compact(i, n, mask, parts[t][q]);
+                    }
+                }
+            });
+            std::vector<std::vector<Point>> result(rects.size());
+            for (size_t q = 0; q < rects.size(); ++q)
+            {
+                for (size_t t = 0; t < chunks; ++t)
                 {
-                    // divide the rectangle into four sub-rectangles
-                    double x_mid = (current.bottomLeft.x + current.topRight.x) / 2.0;
-                    double y_mid = (current.bottomLeft.y + current.topRight.y) / 2.0;
-                    Point p1(current.bottomLeft.x, current.bottomLeft.y);
-                    Point p2(x_mid, y_mid);
-                    Point p3(x_mid, current.topRight.y);
-                    Point p4(current.bottomLeft.x, y_mid);
-                    Point p5(current.topRight.x, y_mid);
-                    Point p6(current.topRight.x, current.topRight.y);
-                    Point p7(x_mid, current.bottomLeft.y);
-                    Rectangle r1(p1, p2);
-                    Rectangle r2(p2, p6);
-                    Rectangle r3(p4, p3);
-                    Rectangle r4(p7, p5);
-                    queue.push_back(r1);
-                    queue.push_back(r2);
-                    queue.push_back(r3);
-                    queue.push_back(r4);
+                    result[q].insert(result[q].end(), parts[t][q].begin(), parts[t][q].end());
                 }
-                else
+            }
+            return result;
+        }
+
+        /**
+         * count the points inside several rectangles in one pass over the points
+         *
+         * @param rects: query rectangles
+         * @return number of points inside each rectangle, in the order of `rects`
+         */
+        [[nodiscard]] std::vector<size_t> countBatch(const std::vector<Rectangle>& rects) const
+        {
+            std::vector<std::vector<size_t>> parts(threadCount(threads), std::vector<size_t>(rects.size()));
+            const size_t chunks = parallelChunks(xs.size(), threads, GRAIN, [&](size_t t, size_t begin, size_t end)
+            {
+                uint8_t mask[BLOCK];
+                for (size_t i = begin; i < end; i += BLOCK)
                 {
-                    result.push_back(current);
+                    const size_t n = std::min(BLOCK, end - i);
+                    for (size_t q = 0; q < rects.size(); ++q)
+                    {
+                        scan(rects[q], i, n, mask);
+                        parts[t][q] += sum(n, mask);
+                    }
+                }
+            });
+            std::vector<size_t> result(rects.size());
+            for (size_t t = 0; t < chunks; ++t)
+            {
+                for (size_t q = 0; q < rects.size(); ++q)
+                {
+                    result[q] += parts[t][q];
                 }
             }
-            for (auto r : result)
+            return result;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return xs.size();
+        }
+
+    private:
+        static constexpr size_t BLOCK = 1024;
+        // minimum number of points per thread
+        static constexpr size_t GRAIN = 1 << 16;
+
+        std::vector<double> xs;
+        std::vector<double> ys;
+        unsigned threads;
+
+        void scan(const Rectangle rect, const size_t begin, const size_t n, uint8_t* mask) const
+        {
+            const double x_min = rect.bottomLeft.x;
+            const double x_max = rect.topRight.x;
+            const double y_min = rect.bottomLeft.y;
+            const double y_max = rect.topRight.y;
+            const double* x = xs.data() + begin;
+            const double* y = ys.data() + begin;
+            for (size_t i = 0; i < n; ++i)
+            {
+                mask[i] = static_cast<uint8_t>((x[i] >= x_min) & (x[i] <= x_max) & (y[i] >= y_min) & (y[i] <= y_max));
+            }
+        }
+
+        void compact(const size_t begin, const size_t n, const uint8_t* mask, std::vector<Point>& result) const
+        {
+            // write every point and advance only on hits, so the loop has no data dependent branch
+            size_t k = result.size();
+            result.resize(k + n);
+            Point* out = result.data();
+            for (size_t i = 0; i < n; ++i)
+            {
+                out[k] = Point(xs[begin + i], ys[begin + i]);
+                k += mask[i];
+            }
+            result.resize(k);
+        }
+
+        static size_t sum(const size_t n, const uint8_t* mask)
+        {
+            size_t hits = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                hits += mask[i];
+            }
+            return hits;
+        }
+    };
+
+    /**
+     * Uniform grid over the bounding box of the points.
+     *
+     * The cell size is chosen so that a cell holds about `pointsPerCell` points on average. Points are stored cell by
+     * cell in one array (counting sort), cells completely inside a query are copied without testing their points.
+     */
+    class GridIndex
+    {
+    public:
+        /**
+         * Constructor of the grid index.
+         *
+         * @param points: points to index
+         * @param pointsPerCell: average number of points per cell the cell size is chosen for
+         */
+        explicit GridIndex(const std::vector<Point>& points, const double pointsPerCell = 8.0)
+        {
+            if (points.empty())
+            {
+                return;
+            }
+            double x_min = points[0].x;
+            double x_max = points[0].x;
+            double y_min = points[0].y;
+            double y_max = points[0].y;
+            for (Point point : points)
+            {
+                x_min = std::min(x_min, point.x);
+                x_max = std::max(x_max, point.x);
+                y_min = std::min(y_min, point.y);
+                y_max = std::max(y_max, point.y);
+            }
+            origin = Point(x_min, y_min);
+            // square cells covering the bounding box with n / pointsPerCell cells, degenerate boxes get a single row
+            const double cells = std::max(1.0, static_cast<double>(points.size()) / pointsPerCell);
+            const double width = x_max - x_min;
+            const double height = y_max - y_min;
+            double size = width > 0 && height > 0 ? std::sqrt(width * height / cells) : std::max(width, height) / cells;
+            if (!(size > 0))
+            {
+                size = 1.0;
+            }
+            inverse = 1.0 / size;
+            cols = std::min(static_cast<size_t>(width * inverse) + 1, MAX_SIDE);
+            rows = std::min(static_cast<size_t>(height * inverse) + 1, MAX_SIDE);
+            start.assign(cols * rows + 1, 0);
+            std::vector<size_t> cellOf(points.size());
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                cellOf[i] = row(points[i].y) * cols + col(points[i].x);
+                ++start[cellOf[i] + 1];
+            }
+            for (size_t c = 0; c < cols * rows; ++c)
+            {
+                start[c + 1] += start[c];
+            }
+            std::vector<size_t> fill(start.begin(), start.end() - 1);
+            this->points.resize(points.size());
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                this->points[fill[cellOf[i]]++] = points[i];
+            }
+        }
+
+        /**
+         * query the points inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result) const
+        {
+            if (points.empty())
+            {
+                return;
+            }
+            const double x_min = rect.bottomLeft.x;
+            const double x_max = rect.topRight.x;
+            const double y_min = rect.bottomLeft.y;
+            const double y_max = rect.topRight.y;
+            if (x_max < x_min || y_max < y_min)
             {
-                std::vector<Point> pointsInRect = query(r);
-                this->result.push_back(std::make_tuple(r, pointsInRect));
+                return;
+            }
+            const size_t c0 = col(x_min);
+            const size_t c1 = col(x_max);
+            const size_t r0 = row(y_min);
+            const size_t r1 = row(y_max);
+            for (size_t r = r0; r <= r1; ++r)
+            {
+                for (size_t c = c0; c <= c1; ++c)
+                {
+                    const Point* begin = points.data() + start[r * cols + c];
+                    const Point* end = points.data() + start[r * cols + c + 1];
+                    // cells strictly inside the covered block lie inside the rectangle
+                    if (r > r0 && r < r1 && c > c0 && c < c1)
+                    {
+                        result.insert(result.end(), begin, end);
+                        continue;
+                    }
+                    for (const Point* point = begin; point != end; ++point)
+                    {
+                        if (point->x >= x_min && point->x <= x_max && point->y >= y_min && point->y <= y_max)
+                        {
+                            result.push_back(*point);
+                        }
+                    }
+                }
             }
         }
 
-        auto getResult()
+        std::vector<Point> query(const Rectangle rect) const
         {
+            std::vector<Point> result{};
+            query(rect, result);
             return result;
         }
 
     private:
+        // cap on the number of cells per side
+        static constexpr size_t MAX_SIDE = 1 << 14;
+
+        Point origin;
+        double inverse = 1.0;
+        size_t cols = 0;
+        size_t rows = 0;
+        // points of cell c are points[start[c], start[c + 1])
+        std::vector<size_t> start{};
         std::vector<Point> points{};
-        std::vector<std::tuple<Rectangle, std::vector<Point>>> result;
+
+        [[nodiscard]] size_t col(const double x) const
+        {
+            const double scaled = std::floor((x - origin.x) * inverse);
+            return scaled <= 0 ? 0 : std::min(static_cast<size_t>(scaled), cols - 1);
+        }
+
+        [[nodiscard]] size_t row(const double y) const
+        {
+            const double scaled = std::floor((y - origin.y) * inverse);
+            return scaled <= 0 ? 0 : std::min(static_cast<size_t>(scaled), rows - 1);
+        }
     };
-}
 
-#endif //TREE_H
+    /**
+     * Points sorted by x in separate x and y arrays.
+     *
+     * A query binary searches the x range and filters y over that slice with a branch free mask the compiler can
+     * vectorize, so the cost grows with the width of the query and not with the number of points.
+     */
+    class SortedSweep
+    {
+    public:
+        /**
+         * Constructor of the sorted sweep index.
+         *
+         * @param points: points to index
+         */
+        explicit SortedSweep(std::vector<Point> points)
+        {
+            std::sort(points.begin(), points.end(), [](const Point& l, const Point& r) { return l.x < r.x; });
+            xs.resize(points.size());
+            ys.resize(points.size());
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                xs[i] = points[i].x;
+                ys[i] = points[i].y;
+            }
+        }
+
+        /**
+         * query the points inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result) const
+        {
+            const double y_min = rect.bottomLeft.y;
+            const double y_max = rect.topRight.y;
+            const size_t begin = std::lower_bound(xs.begin(), xs.end(), rect.bottomLeft.x) - xs.begin();
+            const size_t end = std::upper_bound(xs.begin(), xs.end(), rect.topRight.x) - xs.begin();
+            uint8_t mask[BLOCK];
+            for (size_t i = begin; i < end; i += BLOCK)
+            {
+                const size_t n = std::min(BLOCK, end - i);
+                const double* y = ys.data() + i;
+                for (size_t j = 0; j < n; ++j)
+                {
+                    mask[j] = static_cast<uint8_t>((y[j] >= y_min) & (y[j] <= y_max));
+                }
+                size_t k = result.size();
+                result.resize(k + n);
+                Point* out = result.data();
+                for (size_t j = 0; j < n; ++j)
+                {
+                    out[k] = Point(xs[i + j], y[j]);
+                    k += mask[j];
+                }
+                result.resize(k);
+            }
+        }
+
+        std::vector<Point> query(const Rectangle rect) const
+        {
+            std::vector<Point> result{};
+            query(rect, result);
+            return result;
+        }
+
+    private:
+        static constexpr size_t BLOCK = 1024;
+
+        std::vector<double> xs{};
+        std::vector<double> ys{};
+    };
+}
 
 UTEST(QuadTree, Test)
 {
-    sf::RandomPointGenerator<alg::Point> generator;
+    sf::RandomPointGenerator<alg::Point> generator{42};
     generator.addNormalPoints(32, alg::Point{2.0, 3.0});
     alg::Point p1{0.0, 0.0};
     alg::Point p2{2.0, 3.0};
@@ -308,9 +1211,48 @@ UTEST(QuadTree, Test)
     ASSERT_NEAR(result.size(), 8, 2);
 }
 
+UTEST(QuadTree, RepeatedPoints)
+{
+    // more identical points than the capacity stop splitting at MAX_DEPTH instead of recursing forever
+    std::vector<alg::Point> points(100, alg::Point{0.25, 0.5});
+    alg::QuadTree built(points, 4);
+    std::vector<alg::Point> empty{};
+    alg::QuadTree root(empty, 4, alg::Rectangle{alg::Point{0.0, 0.0}, alg::Point{1.0, 1.0}});
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(root.insert(alg::Point{0.25, 0.5}));
+    }
+    const alg::Rectangle rect{alg::Point{0.2, 0.4}, alg::Point{0.3, 0.6}};
+    std::vector<alg::Point> result{};
+    root.query(rect, result);
+    EXPECT_EQ(result.size(), 100u);
+    result.clear();
+    built.query(rect, result);
+    EXPECT_EQ(result.size(), 100u);
+}
+
+UTEST(QuadTree, Sampled)
+{
+    sf::RandomPointGenerator<alg::Point> generator{42};
+    generator.addUniformPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 64);
+    const alg::Rectangle rect{alg::Point{-0.7, -0.3}, alg::Point{0.45, 0.8}};
+    std::vector<alg::Point> exact{};
+    root.query(rect, exact);
+    const alg::SampledResult sampled = root.querySampled(rect, 100, 3.0);
+    EXPECT_LE(sampled.points.size(), 100u);
+    EXPECT_TRUE(sampled.error > 0);
+    ASSERT_NEAR(sampled.count, static_cast<double>(exact.size()), sampled.error);
+    for (alg::Point point : sampled.points)
+    {
+        EXPECT_TRUE(point.x >= -0.7 && point.x <= 0.45 && point.y >= -0.3 && point.y <= 0.8);
+    }
+}
+
 UTEST(DirectSearch, Test)
 {
-    sf::RandomPointGenerator<alg::Point> generator;
+    sf::RandomPointGenerator<alg::Point> generator{42};
     generator.addNormalPoints(32, alg::Point{2.0, 3.0});
     alg::Point p1{0.0, 0.0};
     alg::Point p2{2.0, 3.0};
@@ -321,3 +1263,112 @@ UTEST(DirectSearch, Test)
     std::vector<alg::Point> result = qt.query(rect);
     ASSERT_NEAR(result.size(), 8, 2);
 }
+
+UTEST(DirectSearch, Divide)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::DirectSearch serial(points);
+    alg::DirectSearch parallel(points);
+    serial.divide(50);
+    parallel.divide(50, true);
+    const alg::CellRange cells = serial.getResult();
+    const alg::CellRange parallelCells = parallel.getResult();
+    ASSERT_EQ(cells.size(), parallelCells.size());
+    size_t i = 0;
+    for (const alg::CellView cell : cells)
+    {
+        const std::vector<alg::Point> expected = serial.query(cell.rect);
+        ASSERT_EQ(cell.points.size(), expected.size());
+        EXPECT_LE(cell.points.size(), 50u);
+        for (size_t j = 0; j < expected.size(); ++j)
+        {
+            EXPECT_EQ(cell.points[j].x, expected[j].x);
+            EXPECT_EQ(cell.points[j].y, expected[j].y);
+        }
+        EXPECT_EQ(cell.rect.bottomLeft.x, parallelCells[i].rect.bottomLeft.x);
+        EXPECT_EQ(cell.rect.topRight.y, parallelCells[i].rect.topRight.y);
+        EXPECT_EQ(cell.points.size(), parallelCells[i].points.size());
+        ++i;
+    }
+}
+
+UTEST(DirectSearch, DivideRepeatedPoints)
+{
+    // more identical points than the capacity stop splitting at QuadTree::MAX_DEPTH instead of recursing forever
+    std::vector<alg::Point> points(100, alg::Point{0.25, 0.5});
+    points.emplace_back(1.0, 1.0);
+    for (const bool parallel : {false, true})
+    {
+        alg::DirectSearch search(points);
+        search.divide(4, parallel);
+        size_t repeated = 0;
+        for (const alg::CellView cell : search.getResult())
+        {
+            if (cell.points.size() > 4)
+            {
+                EXPECT_EQ(cell.points.size(), 100u);
+                ++repeated;
+            }
+        }
+        EXPECT_EQ(repeated, 1u);
+    }
+}
+
+UTEST(ParallelDirectSearch, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(300000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::DirectSearch direct(points);
+    alg::ParallelDirectSearch parallel(points, 4);
+    const std::vector<alg::Rectangle> rects{
+        alg::Rectangle{alg::Point{-1.0, -1.0}, alg::Point{0.5, 2.0}},
+        alg::Rectangle{alg::Point{0.0, 0.0}, alg::Point{0.1, 0.1}},
+        alg::Rectangle{alg::Point{5.0, 5.0}, alg::Point{6.0, 6.0}}
+    };
+    const auto batch = parallel.queryBatch(rects);
+    const auto counts = parallel.countBatch(rects);
+    for (size_t q = 0; q < rects.size(); ++q)
+    {
+        const std::vector<alg::Point> expected = direct.query(rects[q]);
+        const std::vector<alg::Point> result = parallel.query(rects[q]);
+        ASSERT_EQ(result.size(), expected.size());
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            EXPECT_EQ(result[i].x, expected[i].x);
+            EXPECT_EQ(result[i].y, expected[i].y);
+        }
+        EXPECT_EQ(parallel.count(rects[q]), expected.size());
+        EXPECT_EQ(batch[q].size(), expected.size());
+        EXPECT_EQ(counts[q], expected.size());
+    }
+}
+
+UTEST(GridIndex, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    generator.addUniformPoints(5000, alg::Point{4.0, 0.0});
+    auto points = generator.takePoints();
+    alg::DirectSearch direct(points);
+    alg::GridIndex grid(points);
+    alg::SortedSweep sweep(points);
+    const alg::Rectangle rects[4] = {
+        alg::Rectangle{alg::Point{-1.0, -1.0}, alg::Point{0.5, 2.0}},
+        alg::Rectangle{alg::Point{-10.0, -10.0}, alg::Point{10.0, 10.0}},
+        alg::Rectangle{alg::Point{3.5, -0.2}, alg::Point{3.6, 0.3}},
+        alg::Rectangle{alg::Point{20.0, 20.0}, alg::Point{21.0, 21.0}}
+    };
+    for (const alg::Rectangle rect : rects)
+    {
+        const size_t expected = direct.query(rect).size();
+        std::vector<alg::Point> fromGrid{};
+        grid.query(rect, fromGrid);
+        EXPECT_EQ(fromGrid.size(), expected);
+        EXPECT_EQ(sweep.query(rect).size(), expected);
+    }
+}
+
+#endif //TREE_H
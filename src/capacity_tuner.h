@@ -0,0 +1,285 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef CAPACITY_TUNER_H
+#define CAPACITY_TUNER_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Measured query time of one capacity
+     */
+    struct CapacityTiming
+    {
+        int capacity;
+        // fastest run over all sample queries, in seconds
+        double seconds;
+        // points returned by all sample queries
+        size_t hits;
+    };
+
+    /**
+     * Result of a capacity search
+     */
+    struct CapacityTuning
+    {
+        int capacity;
+        // one entry per candidate, in increasing capacity
+        std::vector<CapacityTiming> curve;
+    };
+
+    /**
+     * Picks the QuadTree capacity that answers a sample of queries fastest.
+     *
+     * Above QuadTree::MAX_DEPTH a node is divided exactly when it holds more than `capacity` points and the split does
+     * not depend on the capacity, so the tree of any larger capacity is the tree of the smallest candidate cut off at the
+     * nodes holding at most that many points. Inner nodes keep the points of their subtree, so such a node can be
+     * answered as a leaf.
+     * Only one tree is built, and every candidate is timed on it with the traversal stopping at its cut.
+     */
+    class CapacityTuner
+    {
+    public:
+        /**
+         * Constructor of the tuner.
+         *
+         * @param points: points to index
+         * @param queries: sample of query rectangles
+         */
+        CapacityTuner(std::vector<Point> points, std::vector<Rectangle> queries) : points(std::move(points)),
+            queries(std::move(queries))
+        {
+            if (this->points.empty() || this->queries.empty())
+            {
+                throw std::invalid_argument("Points and queries must not be empty.");
+            }
+        }
+
+        /**
+         * time every candidate capacity
+         *
+         * @param capacities: candidate capacities
+         * @param repeats: number of timed runs per candidate, the fastest is kept
+         * @return fastest capacity and the time of every candidate
+         */
+        [[nodiscard]] CapacityTuning tune(std::vector<int> capacities, const int repeats = 3) const
+        {
+            if (capacities.empty() || repeats <= 0)
+            {
+                throw std::invalid_argument("Capacities and repeats must not be empty.");
+            }
+            std::sort(capacities.begin(), capacities.end());
+            capacities.erase(std::unique(capacities.begin(), capacities.end()), capacities.end());
+            if (capacities.front() <= 0)
+            {
+                throw std::invalid_argument("Capacity must be positive.");
+            }
+            std::vector<Point> copy = points;
+            QuadTree tree(copy, capacities.front());
+            CapacityTuning tuning{capacities.front(), {}};
+            for (const int capacity : capacities)
+            {
+                tuning.curve.push_back(CapacityTiming{capacity, std::numeric_limits<double>::infinity(), 0});
+            }
+            // candidates are interleaved within every repeat, so drift of the machine hits all of them alike
+            std::vector<Point> result{};
+            for (int r = 0; r < repeats; ++r)
+            {
+                for (CapacityTiming& timing : tuning.curve)
+                {
+                    size_t hits = 0;
+                    const auto start = std::chrono::steady_clock::now();
+                    for (const Rectangle& rect : queries)
+                    {
+                        result.clear();
+                        query(tree, static_cast<size_t>(timing.capacity), rect, result);
+                        hits += result.size();
+                    }
+                    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    timing.seconds = std::min(timing.seconds, elapsed.count());
+                    timing.hits = hits;
+                }
+            }
+            double best = std::numeric_limits<double>::infinity();
+            for (const CapacityTiming& timing : tuning.curve)
+            {
+                if (timing.seconds < best)
+                {
+                    best = timing.seconds;
+                    tuning.capacity = timing.capacity;
+                }
+            }
+            return tuning;
+        }
+
+        /**
+         * time the capacities min, 2 min, 4 min, ... up to max
+         *
+         * @param minCapacity: smallest candidate
+         * @param maxCapacity: largest candidate
+         * @param repeats: number of timed runs per candidate
+         * @return fastest capacity and the time of every candidate
+         */
+        [[nodiscard]] CapacityTuning tune(const int minCapacity, const int maxCapacity, const int repeats = 3) const
+        {
+            if (minCapacity <= 0 || maxCapacity < minCapacity)
+            {
+                throw std::invalid_argument("Capacity range must be positive and not empty.");
+            }
+            std::vector<int> capacities{};
+            for (long long c = minCapacity; c < maxCapacity; c *= 2)
+            {
+                capacities.push_back(static_cast<int>(c));
+            }
+            capacities.push_back(maxCapacity);
+            return tune(capacities, repeats);
+        }
+
+        /**
+         * whether a node of a tree built with a smaller capacity is a leaf of the tree of `capacity`
+         *
+         * @param node: node of the tree
+         * @param capacity: capacity of the cut
+         */
+        static bool isLeafAt(const QuadTree& node, const size_t capacity)
+        {
+            return node.isLeaf || node.points.size() <= capacity;
+        }
+
+    private:
+        std::vector<Point> points;
+        std::vector<Rectangle> queries;
+
+        /**
+         * QuadTree::query() on the tree of a larger capacity
+         */
+        static void query(const QuadTree& node, const size_t capacity, const Rectangle& rect,
+                          std::vector<Point>& result)
+        {
+            const Rectangle& r = node.rect;
+            if (rect.topRight.x < r.bottomLeft.x || rect.bottomLeft.x > r.topRight.x ||
+                rect.topRight.y < r.bottomLeft.y || rect.bottomLeft.y > r.topRight.y)
+            {
+                return;
+            }
+            if (rect.bottomLeft.x <= r.bottomLeft.x && rect.topRight.x >= r.topRight.x &&
+                rect.bottomLeft.y <= r.bottomLeft.y && rect.topRight.y >= r.topRight.y)
+            {
+                result.insert(result.end(), node.points.begin(), node.points.end());
+                return;
+            }
+            if (!isLeafAt(node, capacity))
+            {
+                query(*node.topLeft, capacity, rect, result);
+                query(*node.topRight, capacity, rect, result);
+                query(*node.bottomLeft, capacity, rect, result);
+                query(*node.bottomRight, capacity, rect, result);
+                return;
+            }
+            for (const Point point : node.points)
+            {
+                if (point.x >= rect.bottomLeft.x && point.x <= rect.topRight.x && point.y >= rect.bottomLeft.y &&
+                    point.y <= rect.topRight.y)
+                {
+                    result.push_back(point);
+                }
+            }
+        }
+    };
+}
+
+UTEST(CapacityTuner, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    std::vector<alg::Rectangle> queries{};
+    for (size_t i = 0; i < 50; ++i)
+    {
+        const alg::Point c = points[i * 97];
+        queries.emplace_back(alg::Point{c.x - 0.3, c.y - 0.3}, alg::Point{c.x + 0.3, c.y + 0.3});
+    }
+    size_t expected = 0;
+    alg::QuadTree root(points, 32);
+    for (const alg::Rectangle& rect : queries)
+    {
+        std::vector<alg::Point> result{};
+        root.query(rect, result);
+        expected += result.size();
+    }
+    const alg::CapacityTuner tuner(points, queries);
+    const alg::CapacityTuning tuning = tuner.tune(8, 200, 1);
+    ASSERT_EQ(tuning.curve.size(), 6u);
+    EXPECT_EQ(tuning.curve.back().capacity, 200);
+    // every cut of the capacity 8 tree answers like a tree built with that capacity
+    bool listed = false;
+    for (const alg::CapacityTiming& timing : tuning.curve)
+    {
+        EXPECT_EQ(timing.hits, expected);
+        listed = listed || timing.capacity == tuning.capacity;
+    }
+    EXPECT_TRUE(listed);
+}
+
+UTEST(CapacityTuner, Cut)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    // repeated points reach QuadTree::MAX_DEPTH, where the cut must stop like the direct build
+    points.insert(points.end(), 300, points[0]);
+    const alg::QuadTree smallest(points, 8);
+    // leaves of a tree in traversal order, a node counts as a leaf once `isLeaf` says so
+    const auto leaves = [](const alg::QuadTree& root, const std::function<bool(const alg::QuadTree&)>& isLeaf)
+    {
+        std::vector<const alg::QuadTree*> result{};
+        std::vector<const alg::QuadTree*> stack{&root};
+        while (!stack.empty())
+        {
+            const alg::QuadTree* node = stack.back();
+            stack.pop_back();
+            if (isLeaf(*node))
+            {
+                result.push_back(node);
+                continue;
+            }
+            stack.push_back(node->bottomRight.get());
+            stack.push_back(node->bottomLeft.get());
+            stack.push_back(node->topRight.get());
+            stack.push_back(node->topLeft.get());
+        }
+        return result;
+    };
+    for (const int capacity : {8, 16, 32, 64, 128, 200})
+    {
+        const alg::QuadTree direct(points, capacity);
+        const auto expected = leaves(direct, [](const alg::QuadTree& node) { return node.isLeaf; });
+        const auto cut = leaves(smallest, [capacity](const alg::QuadTree& node)
+        {
+            return alg::CapacityTuner::isLeafAt(node, static_cast<size_t>(capacity));
+        });
+        ASSERT_EQ(cut.size(), expected.size());
+        for (size_t i = 0; i < cut.size(); ++i)
+        {
+            const alg::Rectangle& a = cut[i]->rect;
+            const alg::Rectangle& b = expected[i]->rect;
+            EXPECT_TRUE(a.bottomLeft.x == b.bottomLeft.x && a.bottomLeft.y == b.bottomLeft.y &&
+                a.topRight.x == b.topRight.x && a.topRight.y == b.topRight.y);
+            EXPECT_EQ(cut[i]->points.size(), expected[i]->points.size());
+        }
+    }
+}
+
+#endif //CAPACITY_TUNER_H
@@ -0,0 +1,277 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef DENSITY_RASTER_H
+#define DENSITY_RASTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Point counts on a regular grid over a rectangle. Row 0 is the bottom row, cells are stored row by row.
+     */
+    class Raster
+    {
+    public:
+        Raster(const Rectangle extent, const int width, const int height) : extent(extent), width(width),
+                                                                           height(height),
+                                                                           counts(static_cast<size_t>(width) * height)
+        {
+        }
+
+        [[nodiscard]] uint32_t at(const int col, const int row) const
+        {
+            return counts[static_cast<size_t>(row) * width + col];
+        }
+
+        Rectangle extent;
+        int width;
+        int height;
+        std::vector<uint32_t> counts;
+    };
+
+    /**
+     * Density heatmaps from a QuadTree in one traversal.
+     *
+     * A node whose rectangle falls inside a single cell adds its count to that cell without being opened, only leaves
+     * crossing cell borders have their points binned one by one. A point belongs to the cell `floor` of its scaled
+     * coordinate, points on the top or right border of the extent go to the last cell.
+     */
+    class DensityRaster
+    {
+    public:
+        /**
+         * Constructor of the rasterizer. The tree is not owned and must outlive the rasterizer.
+         *
+         * @param tree: index to rasterize
+         * @param extent: area covered by the raster
+         * @param threads: number of worker threads, 0 for the hardware concurrency
+         */
+        DensityRaster(const QuadTree& tree, const Rectangle extent, const unsigned threads = 0) : tree(tree),
+            extent(extent), threads(threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threads)
+        {
+            if (!(extent.topRight.x > extent.bottomLeft.x && extent.topRight.y > extent.bottomLeft.y))
+            {
+                throw std::invalid_argument("Raster extent must have a positive area.");
+            }
+        }
+
+        /**
+         * count the points per cell
+         *
+         * @param width: number of columns
+         * @param height: number of rows
+         * @return count image
+         */
+        [[nodiscard]] Raster render(const int width, const int height) const
+        {
+            if (width <= 0 || height <= 0)
+            {
+                throw std::invalid_argument("Raster size must be positive.");
+            }
+            // split the top of the tree into enough subtrees to keep every worker busy
+            std::vector<const QuadTree*> tasks{&tree};
+            while (tasks.size() < 4 * threads)
+            {
+                std::vector<const QuadTree*> next{};
+                for (const QuadTree* node : tasks)
+                {
+                    if (node->isLeaf)
+                    {
+                        next.push_back(node);
+                        continue;
+                    }
+                    next.push_back(node->topLeft.get());
+                    next.push_back(node->topRight.get());
+                    next.push_back(node->bottomLeft.get());
+                    next.push_back(node->bottomRight.get());
+                }
+                if (next.size() == tasks.size())
+                {
+                    break;
+                }
+                tasks.swap(next);
+            }
+            const Grid grid{extent, width, height};
+            std::vector<std::future<Raster>> workers{};
+            for (unsigned t = 0; t < threads && t < tasks.size(); ++t)
+            {
+                workers.push_back(std::async(std::launch::async, [&, t]
+                {
+                    Raster local(extent, width, height);
+                    for (size_t i = t; i < tasks.size(); i += threads)
+                    {
+                        visit(*tasks[i], grid, local);
+                    }
+                    return local;
+                }));
+            }
+            Raster raster(extent, width, height);
+            for (auto& worker : workers)
+            {
+                const Raster local = worker.get();
+                for (size_t i = 0; i < raster.counts.size(); ++i)
+                {
+                    raster.counts[i] += local.counts[i];
+                }
+            }
+            return raster;
+        }
+
+        /**
+         * count the points per cell for a tile pyramid. Level 0 has the full resolution, every further level halves
+         * both sides by summing blocks of 2 x 2 cells.
+         *
+         * @param width: number of columns at level 0, divisible by 2^(levels - 1)
+         * @param height: number of rows at level 0, divisible by 2^(levels - 1)
+         * @param levels: number of levels
+         * @return count images from the finest to the coarsest level
+         */
+        [[nodiscard]] std::vector<Raster> pyramid(const int width, const int height, const int levels) const
+        {
+            if (levels <= 0 || levels > 30 || width % (1 << (levels - 1)) != 0 || height % (1 << (levels - 1)) != 0)
+            {
+                throw std::invalid_argument("Raster size must be divisible by 2^(levels - 1).");
+            }
+            std::vector<Raster> result{render(width, height)};
+            for (int level = 1; level < levels; ++level)
+            {
+                const Raster& fine = result.back();
+                Raster coarse(extent, fine.width / 2, fine.height / 2);
+                for (int row = 0; row < coarse.height; ++row)
+                {
+                    for (int col = 0; col < coarse.width; ++col)
+                    {
+                        coarse.counts[static_cast<size_t>(row) * coarse.width + col] =
+                            fine.at(2 * col, 2 * row) + fine.at(2 * col + 1, 2 * row) +
+                            fine.at(2 * col, 2 * row + 1) + fine.at(2 * col + 1, 2 * row + 1);
+                    }
+                }
+                result.push_back(std::move(coarse));
+            }
+            return result;
+        }
+
+    private:
+        struct Grid
+        {
+            Rectangle extent;
+            int width;
+            int height;
+
+            [[nodiscard]] int col(const double x) const
+            {
+                const double scaled = (x - extent.bottomLeft.x) / (extent.topRight.x - extent.bottomLeft.x) * width;
+                return std::min(static_cast<int>(std::floor(scaled)), width - 1);
+            }
+
+            [[nodiscard]] int row(const double y) const
+            {
+                const double scaled = (y - extent.bottomLeft.y) / (extent.topRight.y - extent.bottomLeft.y) * height;
+                return std::min(static_cast<int>(std::floor(scaled)), height - 1);
+            }
+
+            [[nodiscard]] bool contains(const Point point) const
+            {
+                return point.x >= extent.bottomLeft.x && point.x <= extent.topRight.x &&
+                    point.y >= extent.bottomLeft.y && point.y <= extent.topRight.y;
+            }
+        };
+
+        const QuadTree& tree;
+        const Rectangle extent;
+        const unsigned threads;
+
+        static void visit(const QuadTree& node, const Grid& grid, Raster& raster)
+        {
+            const Rectangle& r = node.rect;
+            if (node.points.empty() || r.topRight.x < grid.extent.bottomLeft.x ||
+                r.bottomLeft.x > grid.extent.topRight.x || r.topRight.y < grid.extent.bottomLeft.y ||
+                r.bottomLeft.y > grid.extent.topRight.y)
+            {
+                return;
+            }
+            if (grid.contains(r.bottomLeft) && grid.contains(r.topRight))
+            {
+                const int col = grid.col(r.bottomLeft.x);
+                const int row = grid.row(r.bottomLeft.y);
+                if (col == grid.col(r.topRight.x) && row == grid.row(r.topRight.y))
+                {
+                    raster.counts[static_cast<size_t>(row) * grid.width + col] +=
+                        static_cast<uint32_t>(node.points.size());
+                    return;
+                }
+            }
+            if (!node.isLeaf)
+            {
+                visit(*node.topLeft, grid, raster);
+                visit(*node.topRight, grid, raster);
+                visit(*node.bottomLeft, grid, raster);
+                visit(*node.bottomRight, grid, raster);
+                return;
+            }
+            for (Point point : node.points)
+            {
+                if (grid.contains(point))
+                {
+                    ++raster.counts[static_cast<size_t>(grid.row(point.y)) * grid.width + grid.col(point.x)];
+                }
+            }
+        }
+    };
+}
+
+UTEST(DensityRaster, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    const alg::Rectangle extent{alg::Point{-2.0, -1.5}, alg::Point{1.0, 2.5}};
+    const alg::DensityRaster rasterizer(root, extent, 4);
+    const alg::Raster raster = rasterizer.render(30, 20);
+    std::vector<uint32_t> expected(30 * 20);
+    for (alg::Point point : points)
+    {
+        if (point.x < -2.0 || point.x > 1.0 || point.y < -1.5 || point.y > 2.5) continue;
+        const int col = std::min(static_cast<int>(std::floor((point.x + 2.0) / 3.0 * 30)), 29);
+        const int row = std::min(static_cast<int>(std::floor((point.y + 1.5) / 4.0 * 20)), 19);
+        ++expected[row * 30 + col];
+    }
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        EXPECT_EQ(raster.counts[i], expected[i]);
+    }
+}
+
+UTEST(DensityRaster, Pyramid)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    const alg::Rectangle extent{alg::Point{-2.0, -2.0}, alg::Point{2.0, 2.0}};
+    const alg::DensityRaster rasterizer(root, extent);
+    const std::vector<alg::Raster> levels = rasterizer.pyramid(64, 32, 3);
+    ASSERT_EQ(levels.size(), 3u);
+    EXPECT_EQ(levels[2].width, 16);
+    EXPECT_EQ(levels[2].height, 8);
+    const alg::Raster direct = rasterizer.render(16, 8);
+    for (size_t i = 0; i < direct.counts.size(); ++i)
+    {
+        EXPECT_EQ(levels[2].counts[i], direct.counts[i]);
+    }
+}
+
+#endif //DENSITY_RASTER_H
@@ -0,0 +1,245 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef GAUSS_KRONROD_H
+#define GAUSS_KRONROD_H
+
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "asi.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * 7 point Gauss rule with its 15 point Kronrod extension. Nodes are the non-negative Kronrod abscissas on [-1, 1]
+     * in decreasing order, the Gauss nodes are the odd ones and, for an odd Gauss order, the centre.
+     */
+    struct G7K15
+    {
+        static constexpr int GAUSS = 7;
+        static constexpr double XGK[8] = {
+            0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+            0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+            0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+            0.207784955007898467600689403773245, 0.000000000000000000000000000000000
+        };
+        static constexpr double WGK[8] = {
+            0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+            0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+            0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+            0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+        };
+        static constexpr double WG[4] = {
+            0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+            0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+        };
+    };
+
+    /**
+     * 10 point Gauss rule with its 21 point Kronrod extension, laid out like G7K15
+     */
+    struct G10K21
+    {
+        static constexpr int GAUSS = 10;
+        static constexpr double XGK[11] = {
+            0.995657163025808080735527280689003, 0.973906528517171720077964012084452,
+            0.930157491355708226001207180059508, 0.865063366688984510732096688423493,
+            0.780817726586416897063717578345042, 0.679409568299024406234327365114874,
+            0.562757134668604683339000099272694, 0.433395394129247190799265943165784,
+            0.294392862701460198131126603103866, 0.148874338981631210884826001129720,
+            0.000000000000000000000000000000000
+        };
+        static constexpr double WGK[11] = {
+            0.011694638867371874278064396062192, 0.032558162307964727478818972459390,
+            0.054755896574351996031381300244580, 0.075039674810919952767043140916190,
+            0.093125454583697605535065465083366, 0.109387158802297641899210590325805,
+            0.123491976262065851077208067035823, 0.134709217311473325928054001771707,
+            0.142775938577060080797094273138717, 0.147739104901338491374841515972068,
+            0.149445554002916905664936468389821
+        };
+        static constexpr double WG[5] = {
+            0.066671344308688137593568809893332, 0.149451349150580593145776339657697,
+            0.219086362515982043995534934228163, 0.269266719309996355091226921569469,
+            0.295524224714752870173892994651146
+        };
+    };
+
+    /**
+     * Adaptive Gauss-Kronrod quadrature.
+     *
+     * Works like ASI: an interval is accepted when its Kronrod and embedded Gauss estimates differ by less than the
+     * tolerance, otherwise both halves are integrated with half the tolerance. The Gauss points are a subset of the
+     * Kronrod points, so an interval costs 15 evaluations with G7K15 and 21 with G10K21. The rule is exact for
+     * polynomials of degree 22 or 31, so smooth integrands need far fewer intervals than Simpson's rule.
+     */
+    template <typename F = std::function<double(double)>, typename Rule = G7K15>
+    class GaussKronrod
+    {
+    public:
+        static constexpr int POINTS = 2 * static_cast<int>(std::extent_v<decltype(Rule::XGK)>) - 1;
+
+        /**
+         * Constructor of the adaptive Gauss-Kronrod quadrature. After construction, call `integrate()` to get the
+         * integrated value.
+         *
+         * @param f: function to integrate
+         * @param a: lower bound
+         * @param b: upper bound
+         * @param tol: tolerance
+         */
+        GaussKronrod(F f, const double a, const double b, const double tol) : f(std::move(f)), a(a), b(b), tol(tol)
+        {
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(int* counter) const
+        {
+            checkTol();
+            return call(a, b, tol, counter);
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @return integrated value
+         */
+        double integrate() const
+        {
+            int _ = 0;
+            return integrate(&_);
+        }
+
+        /**
+         * set tolerance
+         *
+         * @param tol: tolerance
+         */
+        GaussKronrod setTol(const double tol)
+        {
+            this->tol = tol;
+            return *this;
+        }
+
+    private:
+        // intervals deeper than this are accepted as they are, which bounds the work for singular integrands
+        static constexpr int MAX_DEPTH = 60;
+
+        const F f;
+        const double a;
+        const double b;
+        double tol;
+
+        /**
+         * Kronrod estimate of [a, b], the difference to the Gauss estimate is stored in `error`
+         */
+        double K(const double a, const double b, double& error, int* counter) const
+        {
+            constexpr int last = static_cast<int>(std::extent_v<decltype(Rule::XGK)>) - 1;
+            const double centre = (a + b) / 2;
+            const double half = (b - a) / 2;
+            const double fc = f(centre);
+            double kronrod = Rule::WGK[last] * fc;
+            double gauss = Rule::GAUSS % 2 == 1 ? Rule::WG[last / 2] * fc : 0.0;
+            for (int j = 0; j < last; ++j)
+            {
+                const double x = half * Rule::XGK[j];
+                const double sum = f(centre - x) + f(centre + x);
+                kronrod += Rule::WGK[j] * sum;
+                if (j % 2 == 1)
+                {
+                    gauss += Rule::WG[j / 2] * sum;
+                }
+            }
+            *counter += POINTS;
+            error = std::abs((kronrod - gauss) * half);
+            return kronrod * half;
+        }
+
+        [[nodiscard]] double call(const double a, const double b, const double tol, int* counter,
+                                  const int depth = 0) const
+        {
+            double error = 0.0;
+            const double k = K(a, b, error, counter);
+            if (error < tol || depth >= MAX_DEPTH) return k;
+            const double mid = (a + b) / 2;
+            return call(a, mid, tol / 2, counter, depth + 1) + call(mid, b, tol / 2, counter, depth + 1);
+        }
+
+        void checkTol() const
+        {
+            if (tol <= 0)
+            {
+                throw std::invalid_argument("Tolerance must be positive.");
+            }
+        }
+    };
+
+    /**
+     * make a Gauss-Kronrod quadrature with a chosen rule that inlines its integrand
+     *
+     * @param f: function to integrate
+     * @param a: lower bound
+     * @param b: upper bound
+     * @param tol: tolerance
+     * @return quadrature storing a copy of f
+     */
+    template <typename Rule, typename F>
+    GaussKronrod<std::decay_t<F>, Rule> make_gauss_kronrod(F&& f, const double a, const double b, const double tol)
+    {
+        return GaussKronrod<std::decay_t<F>, Rule>(std::forward<F>(f), a, b, tol);
+    }
+}
+
+UTEST(GaussKronrod, Test)
+{
+    const std::function f = [](const double x) { return x; };
+    int counter = 0;
+    EXPECT_NEAR(alg::GaussKronrod(f, 0, 1, 1e-2).integrate(&counter), 0.5, 1e-15);
+    EXPECT_EQ(counter, 15);
+    // both embedded rules of G10K21 are exact up to degree 19, so a single interval is accepted
+    counter = 0;
+    const double value = alg::make_gauss_kronrod<alg::G10K21>([](const double x) { return std::pow(x, 19); }, 0, 1,
+                                                              1e-12).integrate(&counter);
+    EXPECT_NEAR(value, 1.0 / 20, 1e-15);
+    EXPECT_EQ(counter, 21);
+}
+
+UTEST(GaussKronrod, Oscillatory)
+{
+    const std::function f = [](const double x) { return x + cos(pow(x, 5)); };
+    const double exact = alg::ReuseASI(f, 0, M_PI, 1e-13).integrate();
+    for (const double tol : {1e-4, 1e-8})
+    {
+        int simpson = 0;
+        alg::ASI(f, 0, M_PI, tol).integrate(&simpson);
+        int counter = 0;
+        EXPECT_NEAR(alg::GaussKronrod(f, 0, M_PI, tol).integrate(&counter), exact, tol);
+        EXPECT_LT(counter, simpson);
+        counter = 0;
+        EXPECT_NEAR(alg::make_gauss_kronrod<alg::G10K21>(f, 0, M_PI, tol).integrate(&counter), exact, tol);
+        EXPECT_LT(counter, simpson);
+    }
+    bool thrown = false;
+    try
+    {
+        alg::GaussKronrod(f, 0, 1, 0).integrate();
+    }
+    catch (std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+#endif //GAUSS_KRONROD_H
@@ -0,0 +1,410 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Bucketed KD-tree with median splits.
+     *
+     * The tree is implicit: points are permuted in place so that every node owns a contiguous range, node i has the
+     * children 2i + 1 and 2i + 2, and only the split value and axis of the inner nodes are stored. Every level halves the
+     * ranges at the median of the wider axis, so all leaves hold between capacity / 2 and capacity points whatever the
+     * distribution of the data.
+     */
+    class KdTree
+    {
+    public:
+        /**
+         * Constructor of the KD-tree.
+         *
+         * @param points: points to index
+         * @param capacity: maximum number of points per leaf
+         * @param parallel: build the top levels on separate threads
+         */
+        KdTree(std::vector<Point> points, const int capacity, const bool parallel = false) : points(std::move(points))
+        {
+            if (capacity <= 0)
+            {
+                throw std::invalid_argument("Capacity must be positive.");
+            }
+            // median splits leave ceil(n / 2^levels) points in the largest leaf
+            const size_t n = this->points.size();
+            while (((n + (size_t{1} << levels) - 1) >> levels) > static_cast<size_t>(capacity))
+            {
+                ++levels;
+            }
+            splits.resize((size_t{1} << levels) - 1);
+            axes.resize(splits.size());
+            if (this->points.empty())
+            {
+                return;
+            }
+            box = bounds(0, this->points.size());
+            build(0, 0, this->points.size(), parallel ? 3 : 0);
+        }
+
+        /**
+         * query the points inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result) const
+        {
+            if (!points.empty())
+            {
+                query(0, 0, points.size(), box, rect, result);
+            }
+        }
+
+        std::vector<Point> query(const Rectangle rect) const
+        {
+            std::vector<Point> result{};
+            query(rect, result);
+            return result;
+        }
+
+        /**
+         * query the points within a distance of a center
+         *
+         * @param center: center of the circle
+         * @param radius: radius of the circle
+         * @param result: vector the points are appended to
+         */
+        void queryRadius(const Point center, const double radius, std::vector<Point>& result) const
+        {
+            if (!points.empty() && radius >= 0)
+            {
+                queryRadius(0, 0, points.size(), box, center, radius * radius, result);
+            }
+        }
+
+        /**
+         * find the k nearest points
+         *
+         * @param center: query point
+         * @param k: number of neighbours
+         * @return up to k points ordered by increasing distance
+         */
+        [[nodiscard]] std::vector<Point> nearest(const Point center, const size_t k) const
+        {
+            std::priority_queue<std::pair<double, size_t>> heap{};
+            if (!points.empty() && k > 0)
+            {
+                nearest(0, 0, points.size(), box, center, k, heap);
+            }
+            std::vector<Point> result(heap.size());
+            for (size_t i = heap.size(); i > 0; --i)
+            {
+                result[i - 1] = points[heap.top().second];
+                heap.pop();
+            }
+            return result;
+        }
+
+        /**
+         * @return number of split levels above the leaves
+         */
+        [[nodiscard]] int depth() const
+        {
+            return levels;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return points.size();
+        }
+
+        /**
+         * @return number of points of every leaf, from left to right
+         */
+        [[nodiscard]] std::vector<size_t> leafSizes() const
+        {
+            std::vector<size_t> sizes{};
+            leafSizes(0, 0, points.size(), sizes);
+            return sizes;
+        }
+
+    private:
+        // points, permuted so that every node owns a contiguous range
+        std::vector<Point> points;
+        // split value and axis (0 for x, 1 for y) of every inner node
+        std::vector<double> splits{};
+        std::vector<uint8_t> axes{};
+        int levels = 0;
+        Rectangle box{};
+
+        [[nodiscard]] bool isLeaf(const size_t node) const
+        {
+            return node >= splits.size();
+        }
+
+        [[nodiscard]] Rectangle bounds(const size_t lo, const size_t hi) const
+        {
+            Rectangle r(points[lo], points[lo]);
+            for (size_t i = lo; i < hi; ++i)
+            {
+                r.bottomLeft.x = std::min(r.bottomLeft.x, points[i].x);
+                r.bottomLeft.y = std::min(r.bottomLeft.y, points[i].y);
+                r.topRight.x = std::max(r.topRight.x, points[i].x);
+                r.topRight.y = std::max(r.topRight.y, points[i].y);
+            }
+            return r;
+        }
+
+        void build(const size_t node, const size_t lo, const size_t hi, const int spawnDepth)
+        {
+            if (isLeaf(node))
+            {
+                return;
+            }
+            const size_t mid = lo + (hi - lo) / 2;
+            if (hi > lo)
+            {
+                const Rectangle r = bounds(lo, hi);
+                const uint8_t axis = r.topRight.x - r.bottomLeft.x >= r.topRight.y - r.bottomLeft.y ? 0 : 1;
+                auto begin = points.begin();
+                std::nth_element(begin + static_cast<long>(lo), begin + static_cast<long>(mid),
+                                 begin + static_cast<long>(hi), [axis](const Point& a, const Point& b)
+                                 {
+                                     return axis == 0 ? a.x < b.x : a.y < b.y;
+                                 });
+                axes[node] = axis;
+                splits[node] = axis == 0 ? points[mid].x : points[mid].y;
+            }
+            if (spawnDepth > 0 && hi - lo > (size_t{1} << 16))
+            {
+                std::thread left([&] { build(2 * node + 1, lo, mid, spawnDepth - 1); });
+                build(2 * node + 2, mid, hi, spawnDepth - 1);
+                left.join();
+                return;
+            }
+            build(2 * node + 1, lo, mid, 0);
+            build(2 * node + 2, mid, hi, 0);
+        }
+
+        void leafSizes(const size_t node, const size_t lo, const size_t hi, std::vector<size_t>& sizes) const
+        {
+            if (isLeaf(node))
+            {
+                sizes.push_back(hi - lo);
+                return;
+            }
+            const size_t mid = lo + (hi - lo) / 2;
+            leafSizes(2 * node + 1, lo, mid, sizes);
+            leafSizes(2 * node + 2, mid, hi, sizes);
+        }
+
+        [[nodiscard]] Rectangle child(const size_t node, const Rectangle r, const bool right) const
+        {
+            Rectangle c = r;
+            double& edge = axes[node] == 0 ? (right ? c.bottomLeft.x : c.topRight.x)
+                               : (right ? c.bottomLeft.y : c.topRight.y);
+            edge = splits[node];
+            return c;
+        }
+
+        void query(const size_t node, const size_t lo, const size_t hi, const Rectangle r, const Rectangle rect,
+                   std::vector<Point>& result) const
+        {
+            if (lo == hi || rect.topRight.x < r.bottomLeft.x || rect.bottomLeft.x > r.topRight.x ||
+                rect.topRight.y < r.bottomLeft.y || rect.bottomLeft.y > r.topRight.y)
+            {
+                return;
+            }
+            if (rect.bottomLeft.x <= r.bottomLeft.x && rect.topRight.x >= r.topRight.x &&
+                rect.bottomLeft.y <= r.bottomLeft.y && rect.topRight.y >= r.topRight.y)
+            {
+                result.insert(result.end(), points.begin() + static_cast<long>(lo),
+                              points.begin() + static_cast<long>(hi));
+                return;
+            }
+            if (isLeaf(node))
+            {
+                for (size_t i = lo; i < hi; ++i)
+                {
+                    const Point& point = points[i];
+                    if (point.x >= rect.bottomLeft.x && point.x <= rect.topRight.x && point.y >= rect.bottomLeft.y &&
+                        point.y <= rect.topRight.y)
+                    {
+                        result.push_back(point);
+                    }
+                }
+                return;
+            }
+            const size_t mid = lo + (hi - lo) / 2;
+            query(2 * node + 1, lo, mid, child(node, r, false), rect, result);
+            query(2 * node + 2, mid, hi, child(node, r, true), rect, result);
+        }
+
+        static double distance2(const Rectangle r, const Point p)
+        {
+            const double dx = std::max({r.bottomLeft.x - p.x, 0.0, p.x - r.topRight.x});
+            const double dy = std::max({r.bottomLeft.y - p.y, 0.0, p.y - r.topRight.y});
+            return dx * dx + dy * dy;
+        }
+
+        static double distance2(const Point a, const Point b)
+        {
+            return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+        }
+
+        void queryRadius(const size_t node, const size_t lo, const size_t hi, const Rectangle r, const Point center,
+                         const double radius2, std::vector<Point>& result) const
+        {
+            if (lo == hi || distance2(r, center) > radius2)
+            {
+                return;
+            }
+            if (isLeaf(node))
+            {
+                for (size_t i = lo; i < hi; ++i)
+                {
+                    if (distance2(points[i], center) <= radius2)
+                    {
+                        result.push_back(points[i]);
+                    }
+                }
+                return;
+            }
+            const size_t mid = lo + (hi - lo) / 2;
+            queryRadius(2 * node + 1, lo, mid, child(node, r, false), center, radius2, result);
+            queryRadius(2 * node + 2, mid, hi, child(node, r, true), center, radius2, result);
+        }
+
+        void nearest(const size_t node, const size_t lo, const size_t hi, const Rectangle r, const Point center,
+                     const size_t k, std::priority_queue<std::pair<double, size_t>>& heap) const
+        {
+            if (lo == hi || (heap.size() == k && distance2(r, center) > heap.top().first))
+            {
+                return;
+            }
+            if (isLeaf(node))
+            {
+                for (size_t i = lo; i < hi; ++i)
+                {
+                    const double d = distance2(points[i], center);
+                    if (heap.size() < k)
+                    {
+                        heap.emplace(d, i);
+                    }
+                    else if (d < heap.top().first)
+                    {
+                        heap.pop();
+                        heap.emplace(d, i);
+                    }
+                }
+                return;
+            }
+            // descend into the side of the split holding the center first, it tightens the bound fastest
+            const size_t mid = lo + (hi - lo) / 2;
+            const Rectangle left = child(node, r, false);
+            const Rectangle right = child(node, r, true);
+            const double coordinate = axes[node] == 0 ? center.x : center.y;
+            if (coordinate < splits[node])
+            {
+                nearest(2 * node + 1, lo, mid, left, center, k, heap);
+                nearest(2 * node + 2, mid, hi, right, center, k, heap);
+            }
+            else
+            {
+                nearest(2 * node + 2, mid, hi, right, center, k, heap);
+                nearest(2 * node + 1, lo, mid, left, center, k, heap);
+            }
+        }
+    };
+}
+
+UTEST(KdTree, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    generator.addUniformPoints(5000, alg::Point{6.0, 0.0});
+    auto points = generator.takePoints();
+    alg::DirectSearch direct(points);
+    const alg::KdTree tree(points, 32, true);
+    for (const size_t size : tree.leafSizes())
+    {
+        EXPECT_LE(size, 32u);
+        EXPECT_GE(size, 16u);
+    }
+    const alg::Rectangle rects[3] = {
+        alg::Rectangle{alg::Point{-1.0, -1.0}, alg::Point{0.5, 2.0}},
+        alg::Rectangle{alg::Point{-10.0, -10.0}, alg::Point{10.0, 10.0}},
+        alg::Rectangle{alg::Point{5.5, -0.2}, alg::Point{5.6, 0.3}}
+    };
+    for (const alg::Rectangle rect : rects)
+    {
+        EXPECT_EQ(tree.query(rect).size(), direct.query(rect).size());
+    }
+    const alg::Point center{0.3, -0.2};
+    std::vector<alg::Point> inside{};
+    tree.queryRadius(center, 0.5, inside);
+    size_t expected = 0;
+    for (alg::Point point : points)
+    {
+        if ((point.x - 0.3) * (point.x - 0.3) + (point.y + 0.2) * (point.y + 0.2) <= 0.25) ++expected;
+    }
+    EXPECT_EQ(inside.size(), expected);
+}
+
+UTEST(KdTree, LeafCapacity)
+{
+    // one point more than fills 2^k leaves exactly needs another level
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(32 * 8 + 1, alg::Point{0.0, 0.0});
+    const auto points = generator.takePoints();
+    const alg::KdTree tree(points, 32);
+    EXPECT_EQ(tree.depth(), 4);
+    size_t total = 0;
+    for (const size_t size : tree.leafSizes())
+    {
+        EXPECT_LE(size, 32u);
+        EXPECT_GE(size, 16u);
+        total += size;
+    }
+    EXPECT_EQ(total, points.size());
+    const alg::KdTree small(std::vector<alg::Point>(points.begin(), points.begin() + 65), 32);
+    for (const size_t size : small.leafSizes())
+    {
+        EXPECT_LE(size, 32u);
+    }
+}
+
+UTEST(KdTree, Nearest)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(5000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    const alg::KdTree tree(points, 16);
+    const alg::Point center{0.7, 0.1};
+    std::vector<double> distances{};
+    for (alg::Point point : points)
+    {
+        distances.push_back((point.x - 0.7) * (point.x - 0.7) + (point.y - 0.1) * (point.y - 0.1));
+    }
+    std::sort(distances.begin(), distances.end());
+    const std::vector<alg::Point> found = tree.nearest(center, 10);
+    ASSERT_EQ(found.size(), 10u);
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        const double d = (found[i].x - 0.7) * (found[i].x - 0.7) + (found[i].y - 0.1) * (found[i].y - 0.1);
+        EXPECT_EQ(d, distances[i]);
+    }
+}
+
+#endif //KD_TREE_H
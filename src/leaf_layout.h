@@ -0,0 +1,338 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef LEAF_LAYOUT_H
+#define LEAF_LAYOUT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Order in which the leaves of a QuadTree are laid out
+     */
+    enum class LeafOrder
+    {
+        // order of QuadTree::query(): top left, top right, bottom left, bottom right
+        Insertion,
+        // Z-order
+        Morton,
+        // Hilbert curve
+        Hilbert
+    };
+
+    /**
+     * Packed copy of a QuadTree with the points of all leaves in one array.
+     *
+     * The leaves are sorted along a space filling curve, so leaves that are close in the array are close in space and
+     * a range query spanning several leaves reads few separate runs of memory. All three orders are hierarchical, every
+     * subtree owns one contiguous run of points and nodes inside the query are copied in one piece.
+     */
+    class LeafLayout
+    {
+    public:
+        /**
+         * Constructor of the layout. The tree is only read during construction.
+         *
+         * @param tree: tree to pack
+         * @param order: order of the leaves
+         */
+        LeafLayout(const QuadTree& tree, const LeafOrder order)
+        {
+            std::vector<Leaf> leaves{};
+            int depth = 0;
+            flatten(tree, 0, 0, 0, leaves, depth);
+            // one bit per level and axis, a 64 bit key holds the QuadTree::MAX_DEPTH levels
+            static_assert(QuadTree::MAX_DEPTH <= 32, "Curve keys hold at most 32 levels.");
+            if (depth > 32)
+            {
+                throw std::invalid_argument("Tree must not be deeper than 32 levels.");
+            }
+            const int bits = depth;
+            for (Leaf& leaf : leaves)
+            {
+                // cell of the leaf on the finest level, any cell inside a quadrant sorts it correctly
+                const int shift = bits - leaf.depth;
+                const uint64_t x = leaf.x << shift;
+                const uint64_t y = leaf.y << shift;
+                switch (order)
+                {
+                case LeafOrder::Insertion:
+                    break;
+                case LeafOrder::Morton:
+                    leaf.key = morton(x, y);
+                    break;
+                case LeafOrder::Hilbert:
+                    leaf.key = hilbert(x, y, bits);
+                    break;
+                }
+            }
+            std::stable_sort(leaves.begin(), leaves.end(), [](const Leaf& l, const Leaf& r) { return l.key < r.key; });
+            for (const Leaf& leaf : leaves)
+            {
+                const std::vector<Point>& leafPoints = nodes[leaf.node].source->points;
+                nodes[leaf.node].begin = points.size();
+                points.insert(points.end(), leafPoints.begin(), leafPoints.end());
+                nodes[leaf.node].end = points.size();
+            }
+            // children follow their parent, so a reverse pass sees every child before its parent
+            for (size_t i = nodes.size(); i > 0; --i)
+            {
+                Node& node = nodes[i - 1];
+                node.source = nullptr;
+                if (node.children[0] < 0)
+                {
+                    continue;
+                }
+                node.begin = SIZE_MAX;
+                node.end = 0;
+                for (const int child : node.children)
+                {
+                    node.begin = std::min(node.begin, nodes[child].begin);
+                    node.end = std::max(node.end, nodes[child].end);
+                }
+            }
+        }
+
+        /**
+         * query the points inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result) const
+        {
+            visit(0, rect, [&](const size_t begin, const size_t end, const bool whole)
+            {
+                if (whole)
+                {
+                    result.insert(result.end(), points.begin() + static_cast<long>(begin),
+                                  points.begin() + static_cast<long>(end));
+                    return;
+                }
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const Point& point = points[i];
+                    if (point.x >= rect.bottomLeft.x && point.x <= rect.topRight.x && point.y >= rect.bottomLeft.y &&
+                        point.y <= rect.topRight.y)
+                    {
+                        result.push_back(point);
+                    }
+                }
+            });
+        }
+
+        /**
+         * count the separate runs of the point array a query reads
+         *
+         * @param rect: query rectangle
+         * @param pageSize: size of a memory page in bytes
+         * @return number of contiguous runs and number of distinct pages touched
+         */
+        [[nodiscard]] std::pair<size_t, size_t> footprint(const Rectangle rect, const size_t pageSize = 4096) const
+        {
+            std::vector<std::pair<size_t, size_t>> ranges{};
+            visit(0, rect, [&](const size_t begin, const size_t end, bool)
+            {
+                if (begin < end) ranges.emplace_back(begin, end);
+            });
+            std::sort(ranges.begin(), ranges.end());
+            size_t runs = 0;
+            size_t pages = 0;
+            size_t runEnd = 0;
+            size_t lastPage = SIZE_MAX;
+            for (const auto& [begin, end] : ranges)
+            {
+                if (runs == 0 || begin != runEnd) ++runs;
+                runEnd = end;
+                const size_t first = begin * sizeof(Point) / pageSize;
+                const size_t last = (end * sizeof(Point) - 1) / pageSize;
+                pages += last - first + 1 - (first == lastPage ? 1 : 0);
+                lastPage = last;
+            }
+            return {runs, pages};
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return points.size();
+        }
+
+    private:
+        struct Node
+        {
+            Rectangle rect;
+            // top left, top right, bottom left, bottom right, -1 for a leaf
+            int children[4];
+            // points of the subtree are points[begin, end)
+            size_t begin;
+            size_t end;
+            // only valid during construction
+            const QuadTree* source;
+        };
+
+        struct Leaf
+        {
+            size_t node;
+            int depth;
+            // quadrant coordinates on the level of the leaf, y grows upwards
+            uint64_t x;
+            uint64_t y;
+            uint64_t key;
+        };
+
+        std::vector<Node> nodes{};
+        std::vector<Point> points{};
+
+        size_t flatten(const QuadTree& tree, const int depth, const uint64_t x, const uint64_t y,
+                       std::vector<Leaf>& leaves, int& maxDepth)
+        {
+            const size_t index = nodes.size();
+            nodes.push_back(Node{tree.rect, {-1, -1, -1, -1}, 0, 0, &tree});
+            maxDepth = std::max(maxDepth, depth);
+            if (tree.isLeaf)
+            {
+                leaves.push_back(Leaf{index, depth, x, y, leaves.size()});
+                return index;
+            }
+            const QuadTree* children[4] = {
+                tree.topLeft.get(), tree.topRight.get(), tree.bottomLeft.get(), tree.bottomRight.get()
+            };
+            const uint64_t dx[4] = {0, 1, 0, 1};
+            const uint64_t dy[4] = {1, 1, 0, 0};
+            for (int i = 0; i < 4; ++i)
+            {
+                const size_t child = flatten(*children[i], depth + 1, 2 * x + dx[i], 2 * y + dy[i], leaves, maxDepth);
+                nodes[index].children[i] = static_cast<int>(child);
+            }
+            return index;
+        }
+
+        template <typename F>
+        void visit(const size_t index, const Rectangle rect, const F& f) const
+        {
+            const Node& node = nodes[index];
+            const Rectangle& r = node.rect;
+            if (node.begin == node.end || rect.topRight.x < r.bottomLeft.x || rect.bottomLeft.x > r.topRight.x ||
+                rect.topRight.y < r.bottomLeft.y || rect.bottomLeft.y > r.topRight.y)
+            {
+                return;
+            }
+            if (rect.bottomLeft.x <= r.bottomLeft.x && rect.topRight.x >= r.topRight.x &&
+                rect.bottomLeft.y <= r.bottomLeft.y && rect.topRight.y >= r.topRight.y)
+            {
+                f(node.begin, node.end, true);
+                return;
+            }
+            if (node.children[0] < 0)
+            {
+                f(node.begin, node.end, false);
+                return;
+            }
+            for (const int child : node.children)
+            {
+                visit(child, rect, f);
+            }
+        }
+
+        static uint64_t morton(const uint64_t x, const uint64_t y)
+        {
+            uint64_t key = 0;
+            for (int i = 0; i < 32; ++i)
+            {
+                key |= ((x >> i) & 1) << (2 * i);
+                key |= ((y >> i) & 1) << (2 * i + 1);
+            }
+            return key;
+        }
+
+        static uint64_t hilbert(uint64_t x, uint64_t y, const int bits)
+        {
+            uint64_t key = 0;
+            for (uint64_t s = bits == 0 ? 0 : uint64_t{1} << (bits - 1); s > 0; s >>= 1)
+            {
+                const uint64_t rx = (x & s) > 0;
+                const uint64_t ry = (y & s) > 0;
+                key += s * s * ((3 * rx) ^ ry);
+                // rotate the quadrant so the sub-curve starts at its lower left corner
+                if (ry == 0)
+                {
+                    if (rx == 1)
+                    {
+                        x = s - 1 - (x & (s - 1));
+                        y = s - 1 - (y & (s - 1));
+                    }
+                    std::swap(x, y);
+                }
+                x &= s - 1;
+                y &= s - 1;
+            }
+            return key;
+        }
+    };
+}
+
+UTEST(LeafLayout, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    const alg::Rectangle rect{alg::Point{-1.0, -0.5}, alg::Point{0.7, 1.5}};
+    std::vector<alg::Point> expected{};
+    root.query(rect, expected);
+    const alg::LeafOrder orders[3] = {alg::LeafOrder::Insertion, alg::LeafOrder::Morton, alg::LeafOrder::Hilbert};
+    size_t runs[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const alg::LeafLayout layout(root, orders[i]);
+        EXPECT_EQ(layout.size(), points.size());
+        std::vector<alg::Point> result{};
+        layout.query(rect, result);
+        EXPECT_EQ(result.size(), expected.size());
+        runs[i] = layout.footprint(rect).first;
+    }
+    // a connected query touches fewer runs along the Hilbert curve than along the Z curve
+    EXPECT_LE(runs[2], runs[1]);
+}
+
+UTEST(LeafLayout, RepeatedPoints)
+{
+    // the repeated points split down to QuadTree::MAX_DEPTH, so the keys need every level
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(2000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    const alg::Point repeated = points[0];
+    points.insert(points.end(), 100, repeated);
+    const alg::Point near{repeated.x + 1e-9, repeated.y - 1e-9};
+    points.insert(points.end(), 40, near);
+    alg::QuadTree root(points, 4);
+    const alg::Rectangle rects[3] = {
+        alg::Rectangle{repeated, repeated},
+        alg::Rectangle{alg::Point{repeated.x - 1e-3, repeated.y - 1e-3}, alg::Point{repeated.x + 1e-3, repeated.y + 1e-3}},
+        alg::Rectangle{alg::Point{repeated.x - 0.5, repeated.y - 0.5}, alg::Point{repeated.x + 0.5, repeated.y + 0.5}}
+    };
+    for (const alg::LeafOrder order : {alg::LeafOrder::Insertion, alg::LeafOrder::Morton, alg::LeafOrder::Hilbert})
+    {
+        const alg::LeafLayout layout(root, order);
+        EXPECT_EQ(layout.size(), points.size());
+        for (const alg::Rectangle rect : rects)
+        {
+            std::vector<alg::Point> expected{};
+            root.query(rect, expected);
+            std::vector<alg::Point> result{};
+            layout.query(rect, result);
+            EXPECT_EQ(result.size(), expected.size());
+        }
+    }
+}
+
+#endif //LEAF_LAYOUT_H
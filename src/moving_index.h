@@ -0,0 +1,467 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef MOVING_INDEX_H
+#define MOVING_INDEX_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Index of moving points: the latest position of every id plus a history of recent positions.
+     *
+     * Latest positions live in a bucket tree that only stores points in its leaves and remembers the leaf and slot of
+     * every id, so a move inside a leaf is a write in place and a move across leaves climbs to the lowest common
+     * ancestor and descends from there instead of deleting from and reinserting into the whole tree.
+     *
+     * History is a ring of QuadTrees, one per time window of `windowLength`. Expiry drops whole windows, so history
+     * queries are answered at window granularity. Observations may arrive out of order: one older than the latest known
+     * position of its id only goes into the history, and one older than every window still in the ring is dropped.
+     * Updates take an exclusive lock, queries a shared one.
+     */
+    class MovingIndex
+    {
+    public:
+        /**
+         * Constructor of the moving point index.
+         *
+         * @param world: area every position must lie in
+         * @param windowLength: length of a history window
+         * @param windows: number of history windows kept
+         * @param capacity: bucket capacity of the trees
+         */
+        MovingIndex(const Rectangle world, const double windowLength, const size_t windows, const int capacity) :
+            world(world), windowLength(windowLength), capacity(capacity), history(windows)
+        {
+            if (windowLength <= 0 || windows == 0 || capacity <= 0)
+            {
+                throw std::invalid_argument("Window length, window count and capacity must be positive.");
+            }
+            nodes.push_back(Node{world, -1, {-1, -1, -1, -1}, {}});
+        }
+
+        /**
+         * record a new position of an id
+         *
+         * @param id: id of the moving point
+         * @param position: new position
+         * @param time: time of the observation
+         * @return false if the position lies outside the world or the observation is older than the history kept
+         */
+        bool update(const uint64_t id, const Point position, const double time)
+        {
+            if (!contains(world, position))
+            {
+                return false;
+            }
+            const auto index = static_cast<long long>(std::floor(time / windowLength));
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            if (hasNewest && index < newest - static_cast<long long>(history.size()) + 1)
+            {
+                ++late;
+                return false;
+            }
+            move(id, position, time);
+            Window& window = windowAt(index);
+            window.tree->insert(position);
+            return true;
+        }
+
+        /**
+         * @param id: id of the moving point
+         * @param position: set to the latest position if the id is known
+         * @return true if the id is known
+         */
+        bool latest(const uint64_t id, Point& position) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            const auto found = locator.find(id);
+            if (found == locator.end())
+            {
+                return false;
+            }
+            position = nodes[found->second.leaf].entries[found->second.slot].position;
+            return true;
+        }
+
+        /**
+         * query the ids whose latest position is inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param ids: vector the ids are appended to
+         */
+        void queryLatest(const Rectangle rect, std::vector<uint64_t>& ids) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            queryLatest(0, rect, ids);
+        }
+
+        /**
+         * query the recorded positions inside a rectangle from the windows overlapping [from, to]
+         *
+         * @param rect: query rectangle
+         * @param from: start of the time range
+         * @param to: end of the time range
+         * @param result: vector the positions are appended to
+         */
+        void queryHistory(const Rectangle rect, const double from, const double to, std::vector<Point>& result) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            const auto first = static_cast<long long>(std::floor(from / windowLength));
+            const auto last = static_cast<long long>(std::floor(to / windowLength));
+            for (const Window& window : history)
+            {
+                if (window.tree && window.index >= first && window.index <= last)
+                {
+                    window.tree->query(rect, result);
+                }
+            }
+        }
+
+        /**
+         * drop every window that ended before a time
+         *
+         * @param time: oldest time still of interest
+         */
+        void expire(const double time)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            const auto oldest = static_cast<long long>(std::floor(time / windowLength));
+            for (Window& window : history)
+            {
+                if (window.tree && window.index < oldest)
+                {
+                    window.tree.reset();
+                }
+            }
+        }
+
+        /**
+         * @return number of ids with a known position
+         */
+        [[nodiscard]] size_t size() const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return locator.size();
+        }
+
+        /**
+         * @return number of observations dropped because their window had already left the ring
+         */
+        [[nodiscard]] size_t dropped() const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return late;
+        }
+
+    private:
+        struct Entry
+        {
+            uint64_t id;
+            Point position;
+        };
+
+        struct Node
+        {
+            Rectangle rect;
+            int parent;
+            // top left, top right, bottom left, bottom right, -1 for a leaf
+            int children[4];
+            // only filled in leaves
+            std::vector<Entry> entries;
+        };
+
+        struct Location
+        {
+            int leaf;
+            size_t slot;
+            // time of the observation the latest position comes from
+            double time;
+        };
+
+        struct Window
+        {
+            long long index = 0;
+            std::unique_ptr<QuadTree> tree;
+        };
+
+        const Rectangle world;
+        const double windowLength;
+        const int capacity;
+        mutable std::shared_mutex mutex;
+        std::vector<Node> nodes{};
+        std::unordered_map<uint64_t, Location> locator{};
+        std::vector<Window> history;
+        // index of the newest window seen so far
+        long long newest = 0;
+        bool hasNewest = false;
+        size_t late = 0;
+
+        static bool contains(const Rectangle& r, const Point p)
+        {
+            return p.x >= r.bottomLeft.x && p.x <= r.topRight.x && p.y >= r.bottomLeft.y && p.y <= r.topRight.y;
+        }
+
+        /**
+         * same child choice as QuadTree: 0 top left, 1 top right, 2 bottom left, 3 bottom right
+         */
+        static int quadrant(const Rectangle& r, const Point p)
+        {
+            const double x_mid = (r.bottomLeft.x + r.topRight.x) / 2.0;
+            const double y_mid = (r.bottomLeft.y + r.topRight.y) / 2.0;
+            if (p.x <= x_mid && p.y >= y_mid) return 0;
+            if (p.x >= x_mid && p.y >= y_mid) return 1;
+            if (p.x <= x_mid && p.y <= y_mid) return 2;
+            return 3;
+        }
+
+        /**
+         * window of an index no older than the ring, recycling the slot if it holds an older window
+         */
+        Window& windowAt(const long long index)
+        {
+            if (!hasNewest || index > newest)
+            {
+                newest = index;
+                hasNewest = true;
+            }
+            const long long size = static_cast<long long>(history.size());
+            Window& window = history[static_cast<size_t>(((index % size) + size) % size)];
+            if (!window.tree || window.index < index)
+            {
+                // the slot still holds a window that fell out of the ring, drop it whole
+                std::vector<Point> empty{};
+                window.tree = std::make_unique<QuadTree>(empty, capacity, world);
+                window.index = index;
+            }
+            return window;
+        }
+
+        void move(const uint64_t id, const Point position, const double time)
+        {
+            const auto found = locator.find(id);
+            if (found == locator.end())
+            {
+                place(descend(0, position), Entry{id, position}, time);
+                return;
+            }
+            const Location location = found->second;
+            if (time < location.time)
+            {
+                // an older observation arriving late, the latest position stays
+                return;
+            }
+            if (contains(nodes[location.leaf].rect, position))
+            {
+                nodes[location.leaf].entries[location.slot].position = position;
+                found->second.time = time;
+                return;
+            }
+            // climb to the lowest ancestor covering the new position, then descend to its new leaf
+            int ancestor = nodes[location.leaf].parent;
+            while (!contains(nodes[ancestor].rect, position))
+            {
+                ancestor = nodes[ancestor].parent;
+            }
+            remove(location);
+            place(descend(ancestor, position), Entry{id, position}, time);
+        }
+
+        [[nodiscard]] int descend(int node, const Point position) const
+        {
+            while (nodes[node].children[0] >= 0)
+            {
+                node = nodes[node].children[quadrant(nodes[node].rect, position)];
+            }
+            return node;
+        }
+
+        void remove(const Location location)
+        {
+            std::vector<Entry>& entries = nodes[location.leaf].entries;
+            if (location.slot + 1 != entries.size())
+            {
+                entries[location.slot] = entries.back();
+                locator[entries[location.slot].id].slot = location.slot;
+            }
+            entries.pop_back();
+        }
+
+        void place(const int leaf, const Entry entry, const double time)
+        {
+            nodes[leaf].entries.push_back(entry);
+            locator[entry.id] = Location{leaf, nodes[leaf].entries.size() - 1, time};
+            // capped like the history trees, which bounds the depth for repeated positions
+            if (nodes[leaf].entries.size() > static_cast<size_t>(capacity) && depth(leaf) < QuadTree::MAX_DEPTH)
+            {
+                split(leaf);
+            }
+        }
+
+        [[nodiscard]] int depth(int node) const
+        {
+            int d = 0;
+            while (nodes[node].parent >= 0)
+            {
+                node = nodes[node].parent;
+                ++d;
+            }
+            return d;
+        }
+
+        void split(const int leaf)
+        {
+            const Rectangle r = nodes[leaf].rect;
+            const double x_mid = (r.bottomLeft.x + r.topRight.x) / 2.0;
+            const double y_mid = (r.bottomLeft.y + r.topRight.y) / 2.0;
+            const Rectangle rects[4] = {
+                Rectangle(Point(r.bottomLeft.x, y_mid), Point(x_mid, r.topRight.y)),
+                Rectangle(Point(x_mid, y_mid), r.topRight),
+                Rectangle(r.bottomLeft, Point(x_mid, y_mid)),
+                Rectangle(Point(x_mid, r.bottomLeft.y), Point(r.topRight.x, y_mid))
+            };
+            for (int i = 0; i < 4; ++i)
+            {
+                nodes[leaf].children[i] = static_cast<int>(nodes.size());
+                nodes.push_back(Node{rects[i], leaf, {-1, -1, -1, -1}, {}});
+            }
+            std::vector<Entry> entries{};
+            entries.swap(nodes[leaf].entries);
+            for (const Entry& entry : entries)
+            {
+                const int child = nodes[leaf].children[quadrant(r, entry.position)];
+                nodes[child].entries.push_back(entry);
+                Location& location = locator[entry.id];
+                location.leaf = child;
+                location.slot = nodes[child].entries.size() - 1;
+            }
+        }
+
+        void queryLatest(const int node, const Rectangle& rect, std::vector<uint64_t>& ids) const
+        {
+            const Rectangle& r = nodes[node].rect;
+            if (rect.topRight.x < r.bottomLeft.x || rect.bottomLeft.x > r.topRight.x ||
+                rect.topRight.y < r.bottomLeft.y || rect.bottomLeft.y > r.topRight.y)
+            {
+                return;
+            }
+            if (nodes[node].children[0] >= 0)
+            {
+                for (const int child : nodes[node].children)
+                {
+                    queryLatest(child, rect, ids);
+                }
+                return;
+            }
+            for (const Entry& entry : nodes[node].entries)
+            {
+                if (contains(rect, entry.position))
+                {
+                    ids.push_back(entry.id);
+                }
+            }
+        }
+    };
+}
+
+UTEST(MovingIndex, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(8000, alg::Point{0.0, 0.0});
+    const auto positions = generator.takePoints();
+    const alg::Rectangle world{alg::Point{-1.0, -1.0}, alg::Point{1.0, 1.0}};
+    alg::MovingIndex index(world, 10.0, 3, 16);
+    // 2000 ids, each observed four times at increasing times
+    for (size_t step = 0; step < 4; ++step)
+    {
+        for (uint64_t id = 0; id < 2000; ++id)
+        {
+            EXPECT_TRUE(index.update(id, positions[step * 2000 + id], static_cast<double>(step) * 10.0));
+        }
+    }
+    EXPECT_EQ(index.size(), 2000u);
+    EXPECT_FALSE(index.update(0, alg::Point{5.0, 5.0}, 30.0));
+    alg::Point latest;
+    ASSERT_TRUE(index.latest(7, latest));
+    EXPECT_EQ(latest.x, positions[3 * 2000 + 7].x);
+    const alg::Rectangle rect{alg::Point{-0.5, -0.2}, alg::Point{0.3, 0.9}};
+    size_t expected = 0;
+    for (size_t i = 3 * 2000; i < 4 * 2000; ++i)
+    {
+        if (positions[i].x >= -0.5 && positions[i].x <= 0.3 && positions[i].y >= -0.2 && positions[i].y <= 0.9)
+            ++expected;
+    }
+    std::vector<uint64_t> ids{};
+    index.queryLatest(rect, ids);
+    EXPECT_EQ(ids.size(), expected);
+    // the ring keeps the windows of steps 1 to 3, expiry then drops the one of step 1
+    std::vector<alg::Point> history{};
+    index.queryHistory(world, 0.0, 40.0, history);
+    EXPECT_EQ(history.size(), 6000u);
+    index.expire(20.0);
+    history.clear();
+    index.queryHistory(world, 0.0, 40.0, history);
+    EXPECT_EQ(history.size(), 4000u);
+}
+
+UTEST(MovingIndex, RepeatedPositions)
+{
+    // a parked asset reporting the same fix fills one leaf of the history tree past its capacity
+    const alg::Rectangle world{alg::Point{-1.0, -1.0}, alg::Point{1.0, 1.0}};
+    alg::MovingIndex index(world, 60.0, 4, 16);
+    for (int i = 0; i < 40; ++i)
+    {
+        EXPECT_TRUE(index.update(1, alg::Point{0.3, 0.3}, static_cast<double>(i)));
+    }
+    std::vector<alg::Point> history{};
+    index.queryHistory(world, 0.0, 60.0, history);
+    EXPECT_EQ(history.size(), 40u);
+}
+
+UTEST(MovingIndex, OutOfOrder)
+{
+    const alg::Rectangle world{alg::Point{-1.0, -1.0}, alg::Point{1.0, 1.0}};
+    alg::MovingIndex index(world, 10.0, 3, 16);
+    for (uint64_t id = 0; id < 10; ++id)
+    {
+        const double x = static_cast<double>(id) / 20.0;
+        EXPECT_TRUE(index.update(id, alg::Point{x, 0.0}, 50.0));
+        EXPECT_TRUE(index.update(id, alg::Point{x, 0.1}, 60.0));
+        EXPECT_TRUE(index.update(id, alg::Point{x, 0.2}, 70.0));
+    }
+    // older than the ring of windows 50, 60 and 70: dropped, the newest window survives
+    EXPECT_FALSE(index.update(3, alg::Point{-0.5, -0.5}, 40.0));
+    EXPECT_EQ(index.dropped(), 1u);
+    std::vector<alg::Point> history{};
+    index.queryHistory(world, 70.0, 79.0, history);
+    EXPECT_EQ(history.size(), 10u);
+    // inside the ring but older than the latest position of id 3: history only
+    EXPECT_TRUE(index.update(3, alg::Point{-0.5, -0.5}, 55.0));
+    alg::Point latest;
+    ASSERT_TRUE(index.latest(3, latest));
+    EXPECT_EQ(latest.y, 0.2);
+    history.clear();
+    index.queryHistory(world, 50.0, 59.0, history);
+    EXPECT_EQ(history.size(), 11u);
+    std::vector<uint64_t> ids{};
+    index.queryLatest(alg::Rectangle{alg::Point{-0.6, -0.6}, alg::Point{-0.4, -0.4}}, ids);
+    EXPECT_TRUE(ids.empty());
+    // a newer observation still moves it
+    EXPECT_TRUE(index.update(3, alg::Point{-0.5, -0.5}, 75.0));
+    index.queryLatest(alg::Rectangle{alg::Point{-0.6, -0.6}, alg::Point{-0.4, -0.4}}, ids);
+    EXPECT_EQ(ids.size(), 1u);
+}
+
+#endif //MOVING_INDEX_H
@@ -0,0 +1,369 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef ND_TREE_H
+#define ND_TREE_H
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Point in D dimensions
+     */
+    template <size_t D>
+    struct PointN
+    {
+        std::array<double, D> coords{};
+
+        double& operator[](const size_t i)
+        {
+            return coords[i];
+        }
+
+        double operator[](const size_t i) const
+        {
+            return coords[i];
+        }
+    };
+
+    /**
+     * Axis aligned box in D dimensions, the D dimensional Rectangle
+     */
+    template <size_t D>
+    struct BoxN
+    {
+        PointN<D> lower;
+        PointN<D> upper;
+    };
+
+    /**
+     * Bucket tree over D dimensions: a quadtree for D = 2, an octree for D = 3.
+     *
+     * Every inner node splits its box at the midpoint of every axis into 2^D children. Points are permuted so that
+     * every subtree owns a contiguous block, stored as one coordinate array per axis. The per-axis tests are expanded
+     * at compile time over the dimensions, and the leaf scan runs over the coordinate arrays without branches. For
+     * D = 2 the tree also accepts and returns alg::Point and alg::Rectangle, like the other engines. Nodes address the
+     * points with 32 bit offsets to stay compact, so a tree holds at most UINT32_MAX points.
+     */
+    template <size_t D>
+    class BucketTree
+    {
+        static_assert(D >= 1 && D <= 8, "BucketTree supports 1 to 8 dimensions.");
+
+    public:
+        static constexpr size_t CHILDREN = size_t{1} << D;
+
+        /**
+         * Constructor of the bucket tree.
+         *
+         * @param points: points to index
+         * @param capacity: maximum number of points per leaf
+         */
+        BucketTree(const std::vector<PointN<D>>& points, const int capacity) : capacity(capacity)
+        {
+            check(points.size(), capacity);
+            build(points);
+        }
+
+        template <size_t E = D, typename = std::enable_if_t<E == 2>>
+        BucketTree(const std::vector<Point>& points, const int capacity) : capacity(capacity)
+        {
+            check(points.size(), capacity);
+            std::vector<PointN<2>> converted(points.size());
+            for (size_t i = 0; i < points.size(); ++i)
+            {
+                converted[i] = PointN<2>{{points[i].x, points[i].y}};
+            }
+            build(converted);
+        }
+
+        /**
+         * query the points inside a box
+         *
+         * @param box: query box
+         * @param result: vector the points are appended to
+         */
+        void query(const BoxN<D>& box, std::vector<PointN<D>>& result) const
+        {
+            if (!nodes.empty())
+            {
+                query(0, box, [&](const size_t begin, const size_t n, const uint8_t* mask)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        if (!mask || mask[i]) result.push_back(at(begin + i));
+                    }
+                });
+            }
+        }
+
+        template <size_t E = D, typename = std::enable_if_t<E == 2>>
+        void query(const Rectangle rect, std::vector<Point>& result) const
+        {
+            if (!nodes.empty())
+            {
+                const BoxN<2> box{{{rect.bottomLeft.x, rect.bottomLeft.y}}, {{rect.topRight.x, rect.topRight.y}}};
+                query(0, box, [&](const size_t begin, const size_t n, const uint8_t* mask)
+                {
+                    // write every point and advance only on hits, so the loop has no data dependent branch
+                    size_t k = result.size();
+                    result.resize(k + n);
+                    Point* out = result.data();
+                    const double* x = coords[0].data() + begin;
+                    const double* y = coords[1].data() + begin;
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        out[k] = Point(x[i], y[i]);
+                        k += mask ? mask[i] : 1;
+                    }
+                    result.resize(k);
+                });
+            }
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return coords[0].size();
+        }
+
+        [[nodiscard]] size_t nodeCount() const
+        {
+            return nodes.size();
+        }
+
+    private:
+        struct Node
+        {
+            BoxN<D> box;
+            // children are nodes[first, first + CHILDREN), 0 for a leaf
+            uint32_t first;
+            // points of the subtree are [begin, end)
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        // boxes deeper than this are not split, which bounds the depth for repeated points
+        static constexpr int MAX_DEPTH = 48;
+        // leaf points are tested in blocks of this size
+        static constexpr size_t BLOCK = 256;
+
+        int capacity;
+        std::vector<Node> nodes{};
+        std::array<std::vector<double>, D> coords{};
+
+        [[nodiscard]] PointN<D> at(const size_t i) const
+        {
+            PointN<D> p;
+            for (size_t d = 0; d < D; ++d)
+            {
+                p[d] = coords[d][i];
+            }
+            return p;
+        }
+
+        template <size_t... I>
+        static bool intersects(const BoxN<D>& a, const BoxN<D>& b, std::index_sequence<I...>)
+        {
+            return ((a.lower[I] <= b.upper[I] && a.upper[I] >= b.lower[I]) && ...);
+        }
+
+        template <size_t... I>
+        static bool includes(const BoxN<D>& outer, const BoxN<D>& inner, std::index_sequence<I...>)
+        {
+            return ((outer.lower[I] <= inner.lower[I] && outer.upper[I] >= inner.upper[I]) && ...);
+        }
+
+        /**
+         * child index of a point: bit d is set when the point lies above the midpoint of axis d
+         */
+        template <size_t... I>
+        static size_t child(const PointN<D>& p, const PointN<D>& mid, std::index_sequence<I...>)
+        {
+            return ((static_cast<size_t>(p[I] > mid[I]) << I) | ...);
+        }
+
+        template <size_t... I>
+        static BoxN<D> childBox(const BoxN<D>& box, const PointN<D>& mid, const size_t c, std::index_sequence<I...>)
+        {
+            BoxN<D> b = box;
+            ((((c >> I) & 1) ? b.lower[I] = mid[I] : b.upper[I] = mid[I]), ...);
+            return b;
+        }
+
+        template <size_t... I>
+        void scan(const BoxN<D>& box, const size_t i, const size_t n, uint8_t* mask, std::index_sequence<I...>) const
+        {
+            const double* c[D] = {(coords[I].data() + i)...};
+            for (size_t j = 0; j < n; ++j)
+            {
+                mask[j] = static_cast<uint8_t>((((c[I][j] >= box.lower[I]) & (c[I][j] <= box.upper[I])) & ...));
+            }
+        }
+
+        static void check(const size_t size, const int capacity)
+        {
+            if (capacity <= 0)
+            {
+                throw std::invalid_argument("Capacity must be positive.");
+            }
+            if (size > UINT32_MAX)
+            {
+                throw std::length_error("BucketTree holds at most UINT32_MAX points.");
+            }
+        }
+
+        void build(std::vector<PointN<D>> points)
+        {
+            if (points.empty())
+            {
+                return;
+            }
+            BoxN<D> box{points[0], points[0]};
+            for (const PointN<D>& p : points)
+            {
+                for (size_t d = 0; d < D; ++d)
+                {
+                    box.lower[d] = std::min(box.lower[d], p[d]);
+                    box.upper[d] = std::max(box.upper[d], p[d]);
+                }
+            }
+            nodes.push_back(Node{box, 0, 0, static_cast<uint32_t>(points.size())});
+            std::vector<PointN<D>> buffer(points.size());
+            split(0, points, buffer, 0);
+            for (size_t d = 0; d < D; ++d)
+            {
+                coords[d].resize(points.size());
+                for (size_t i = 0; i < points.size(); ++i)
+                {
+                    coords[d][i] = points[i][d];
+                }
+            }
+        }
+
+        void split(const size_t index, std::vector<PointN<D>>& points, std::vector<PointN<D>>& buffer, const int depth)
+        {
+            const Node node = nodes[index];
+            if (node.end - node.begin <= static_cast<uint32_t>(capacity) || depth >= MAX_DEPTH)
+            {
+                return;
+            }
+            PointN<D> mid;
+            for (size_t d = 0; d < D; ++d)
+            {
+                mid[d] = (node.box.lower[d] + node.box.upper[d]) / 2.0;
+            }
+            // counting sort of the block by child index
+            std::array<uint32_t, CHILDREN + 1> start{};
+            for (uint32_t i = node.begin; i < node.end; ++i)
+            {
+                ++start[child(points[i], mid, std::make_index_sequence<D>{}) + 1];
+            }
+            start[0] = node.begin;
+            for (size_t c = 0; c < CHILDREN; ++c)
+            {
+                start[c + 1] += start[c];
+            }
+            std::array<uint32_t, CHILDREN> fill{};
+            std::copy(start.begin(), start.end() - 1, fill.begin());
+            for (uint32_t i = node.begin; i < node.end; ++i)
+            {
+                buffer[fill[child(points[i], mid, std::make_index_sequence<D>{})]++] = points[i];
+            }
+            std::copy(buffer.begin() + node.begin, buffer.begin() + node.end, points.begin() + node.begin);
+            const auto first = static_cast<uint32_t>(nodes.size());
+            nodes[index].first = first;
+            for (size_t c = 0; c < CHILDREN; ++c)
+            {
+                nodes.push_back(Node{childBox(node.box, mid, c, std::make_index_sequence<D>{}), 0, start[c], start[c + 1]});
+            }
+            for (size_t c = 0; c < CHILDREN; ++c)
+            {
+                split(first + c, points, buffer, depth + 1);
+            }
+        }
+
+        /**
+         * `emit(begin, n, mask)` receives runs of points, `mask` flags the hits or is null when all n points are hits
+         */
+        template <typename Emit>
+        void query(const size_t index, const BoxN<D>& box, const Emit& emit) const
+        {
+            const Node& node = nodes[index];
+            if (node.begin == node.end || !intersects(node.box, box, std::make_index_sequence<D>{}))
+            {
+                return;
+            }
+            if (includes(box, node.box, std::make_index_sequence<D>{}))
+            {
+                emit(node.begin, node.end - node.begin, nullptr);
+                return;
+            }
+            if (node.first != 0)
+            {
+                for (size_t c = 0; c < CHILDREN; ++c)
+                {
+                    query(node.first + c, box, emit);
+                }
+                return;
+            }
+            uint8_t mask[BLOCK];
+            for (size_t i = node.begin; i < node.end; i += BLOCK)
+            {
+                const size_t n = std::min<size_t>(BLOCK, node.end - i);
+                scan(box, i, n, mask, std::make_index_sequence<D>{});
+                emit(i, n, mask);
+            }
+        }
+    };
+
+    using Octree = BucketTree<3>;
+}
+
+UTEST(BucketTree, Quadtree)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    const alg::BucketTree<2> tree(points, 32);
+    EXPECT_EQ(tree.size(), points.size());
+    const alg::Rectangle rect{alg::Point{-1.0, -0.5}, alg::Point{0.7, 1.5}};
+    std::vector<alg::Point> expected{};
+    root.query(rect, expected);
+    std::vector<alg::Point> result{};
+    tree.query(rect, result);
+    EXPECT_EQ(result.size(), expected.size());
+}
+
+UTEST(BucketTree, Octree)
+{
+    std::mt19937_64 rng(2024);
+    std::normal_distribution<> normal(0.0, 1.0);
+    std::vector<alg::PointN<3>> points(20000);
+    for (auto& p : points)
+    {
+        p = alg::PointN<3>{{normal(rng), normal(rng), normal(rng)}};
+    }
+    const alg::Octree tree(points, 16);
+    const alg::BoxN<3> box{{{-1.0, -0.5, 0.0}}, {{0.5, 1.0, 2.0}}};
+    size_t expected = 0;
+    for (const auto& p : points)
+    {
+        if (p[0] >= -1.0 && p[0] <= 0.5 && p[1] >= -0.5 && p[1] <= 1.0 && p[2] >= 0.0 && p[2] <= 2.0) ++expected;
+    }
+    std::vector<alg::PointN<3>> result{};
+    tree.query(box, result);
+    EXPECT_EQ(result.size(), expected);
+}
+
+#endif //ND_TREE_H
@@ -0,0 +1,117 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * @param threads: requested number of threads, 0 for the hardware concurrency
+     * @return number of threads to use, at least 1
+     */
+    inline unsigned threadCount(const unsigned threads)
+    {
+        return threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threads;
+    }
+
+    /**
+     * Split [0, n) into one contiguous chunk per thread and call `f(chunk, begin, end)` for each chunk. Chunk `t`
+     * always covers the t-th part of the range, so callers can merge per-chunk results in order. The call returns once
+     * every chunk is done. Below `grain` elements per thread fewer threads are used. If chunks throw, every thread is
+     * still joined and the first exception is rethrown.
+     *
+     * @param n: size of the range
+     * @param threads: number of threads, 0 for the hardware concurrency
+     * @param grain: minimum number of elements per chunk
+     * @param f: callable as f(size_t chunk, size_t begin, size_t end)
+     * @return number of chunks
+     */
+    template <typename F>
+    size_t parallelChunks(const size_t n, const unsigned threads, const size_t grain, F&& f)
+    {
+        const size_t chunks = std::max<size_t>(1, std::min<size_t>(threadCount(threads), n / std::max<size_t>(1, grain)));
+        if (chunks == 1)
+        {
+            f(size_t{0}, size_t{0}, n);
+            return 1;
+        }
+        std::exception_ptr error{};
+        std::mutex errorMutex;
+        const auto run = [&](const size_t t)
+        {
+            try
+            {
+                f(t, n * t / chunks, n * (t + 1) / chunks);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers{};
+        workers.reserve(chunks - 1);
+        try
+        {
+            for (size_t t = 1; t < chunks; ++t)
+            {
+                workers.emplace_back(run, t);
+            }
+        }
+        catch (...)
+        {
+            // a thread could not be started, the ones that were must not be left joinable
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) error = std::current_exception();
+        }
+        if (!error)
+        {
+            run(0);
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return chunks;
+    }
+}
+
+UTEST(ParallelChunks, Exception)
+{
+    for (const size_t failing : {size_t{0}, size_t{2}})
+    {
+        bool thrown = false;
+        try
+        {
+            alg::parallelChunks(400, 4, 1, [failing](const size_t t, size_t, size_t)
+            {
+                if (t == failing)
+                {
+                    throw std::runtime_error("chunk failed");
+                }
+            });
+        }
+        catch (std::runtime_error&)
+        {
+            thrown = true;
+        }
+        EXPECT_TRUE(thrown);
+    }
+}
+
+#endif //PARALLEL_H
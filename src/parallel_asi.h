@@ -0,0 +1,287 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef PARALLEL_ASI_H
+#define PARALLEL_ASI_H
+
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "asi.h"
+#include "parallel.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Adaptive Simpson's Rule on a work stealing pool.
+     *
+     * Every interval whose error test fails becomes two tasks. A worker keeps going with the left half, pushes the right
+     * half onto its own deque, and steals from the front of the other deques when its own runs dry. The accepted
+     * intervals form a tree that is summed in the order of ASI::call() once all workers are done, so the value is
+     * identical to the serial ASI for any number of threads. Every worker counts its evaluations on its own, each
+     * abscissa is evaluated once as in ReuseASI. The integrand must be safe to call from several threads at once.
+     */
+    template <typename F = std::function<double(double)>>
+    class ParallelASI
+    {
+    public:
+        /**
+         * Constructor of the parallel Adaptive Simpson's Rule. After construction, call `integrate()` to get the
+         * integrated value.
+         *
+         * @param f: function to integrate
+         * @param a: lower bound
+         * @param b: upper bound
+         * @param tol: tolerance
+         * @param threads: number of threads, 0 for the hardware concurrency
+         */
+        ParallelASI(F f, const double a, const double b, const double tol, const unsigned threads = 0) :
+            f(std::move(f)), a(a), b(b), tol(tol), threads(threads)
+        {
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @param counter: counter for number of function evaluations
+         * @return integrated value
+         */
+        double integrate(int* counter) const
+        {
+            checkTol();
+            const double mid = (a + b) / 2;
+            const double fa = f(a);
+            const double fm = f(mid);
+            const double fb = f(b);
+            *counter += 3;
+            Node root{};
+            Pool pool(threadCount(threads));
+            pool.workers[0].tasks.push_back(Task{a, b, fa, fm, fb, 1.0 / 6 * (b - a) * (fa + 4 * fm + fb), tol, &root});
+            pool.pending = 1;
+            std::vector<std::thread> helpers{};
+            for (size_t w = 1; w < pool.workers.size(); ++w)
+            {
+                helpers.emplace_back([this, &pool, w] { work(pool, w); });
+            }
+            work(pool, 0);
+            for (auto& helper : helpers)
+            {
+                helper.join();
+            }
+            if (pool.error)
+            {
+                std::rethrow_exception(pool.error);
+            }
+            for (const Worker& worker : pool.workers)
+            {
+                *counter += worker.evaluations;
+            }
+            return sum(root);
+        }
+
+        /**
+         * integrate function f from a to b
+         *
+         * @return integrated value
+         */
+        double integrate() const
+        {
+            int _ = 0;
+            return integrate(&_);
+        }
+
+        /**
+         * set tolerance
+         *
+         * @param tol: tolerance
+         */
+        ParallelASI setTol(const double tol)
+        {
+            this->tol = tol;
+            return *this;
+        }
+
+    private:
+        struct Node
+        {
+            double value = 0.0;
+            std::unique_ptr<Node> left{};
+            std::unique_ptr<Node> right{};
+        };
+
+        struct Task
+        {
+            double a;
+            double b;
+            double fa;
+            double fm;
+            double fb;
+            // Simpson estimate of [a, b]
+            double whole;
+            double tol;
+            Node* node;
+        };
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            int evaluations = 0;
+        };
+
+        struct Pool
+        {
+            std::vector<Worker> workers;
+            // tasks created and not yet finished
+            std::atomic<size_t> pending{0};
+            std::atomic<bool> failed{false};
+            std::exception_ptr error{};
+            std::mutex errorMutex;
+
+            explicit Pool(const unsigned threads) : workers(threads)
+            {
+            }
+        };
+
+        const F f;
+        const double a;
+        const double b;
+        double tol;
+        const unsigned threads;
+
+        void work(Pool& pool, const size_t self) const
+        {
+            Worker& worker = pool.workers[self];
+            while (pool.pending.load() > 0 && !pool.failed.load())
+            {
+                Task task{};
+                if (!take(pool, self, task))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                try
+                {
+                    run(pool, worker, task);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(pool.errorMutex);
+                    if (!pool.error) pool.error = std::current_exception();
+                    pool.failed = true;
+                }
+                pool.pending.fetch_sub(1);
+            }
+        }
+
+        /**
+         * pop from the back of the own deque, or steal from the front of another one
+         */
+        static bool take(Pool& pool, const size_t self, Task& task)
+        {
+            {
+                Worker& worker = pool.workers[self];
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                if (!worker.tasks.empty())
+                {
+                    task = worker.tasks.back();
+                    worker.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < pool.workers.size(); ++i)
+            {
+                Worker& victim = pool.workers[(self + i) % pool.workers.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty())
+                {
+                    task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * refine an interval, following the left halves and handing the right halves to the pool
+         */
+        void run(Pool& pool, Worker& worker, Task task) const
+        {
+            while (true)
+            {
+                const double mid = (task.a + task.b) / 2;
+                const double fl = f((task.a + mid) / 2);
+                const double fr = f((mid + task.b) / 2);
+                worker.evaluations += 2;
+                const double left = 1.0 / 6 * (mid - task.a) * (task.fa + 4 * fl + task.fm);
+                const double right = 1.0 / 6 * (task.b - mid) * (task.fm + 4 * fr + task.fb);
+                const double i_2 = left + right;
+                if (std::abs(task.whole - i_2) < 15 * task.tol)
+                {
+                    task.node->value = i_2;
+                    return;
+                }
+                task.node->left = std::make_unique<Node>();
+                task.node->right = std::make_unique<Node>();
+                // counted before it is visible, so no worker sees zero pending while the task waits
+                pool.pending.fetch_add(1);
+                {
+                    std::lock_guard<std::mutex> lock(worker.mutex);
+                    worker.tasks.push_back(Task{
+                        mid, task.b, task.fm, fr, task.fb, right, task.tol / 2, task.node->right.get()
+                    });
+                }
+                task = Task{task.a, mid, task.fa, fl, task.fm, left, task.tol / 2, task.node->left.get()};
+            }
+        }
+
+        /**
+         * sum of the accepted intervals below a node, in the order of ASI::call()
+         */
+        static double sum(const Node& node)
+        {
+            if (!node.left) return node.value;
+            return sum(*node.left) + sum(*node.right);
+        }
+
+        void checkTol() const
+        {
+            if (tol <= 0)
+            {
+                throw std::invalid_argument("Tolerance must be positive.");
+            }
+        }
+    };
+}
+
+UTEST(ParallelASI, Test)
+{
+    const std::function f = [](const double x) { return x + cos(pow(x, 5)); };
+    for (const double tol : {1e-3, 1e-8})
+    {
+        int serialCounter = 0;
+        const double expected = alg::ASI(f, 0, M_PI, tol).integrate(&serialCounter);
+        int reuseCounter = 0;
+        alg::ReuseASI(f, 0, M_PI, tol).integrate(&reuseCounter);
+        for (const unsigned threads : {1u, 2u, 4u, 7u})
+        {
+            int counter = 0;
+            EXPECT_EQ(alg::ParallelASI(f, 0, M_PI, tol, threads).integrate(&counter), expected);
+            EXPECT_EQ(counter, reuseCounter);
+        }
+    }
+}
+
+#endif //PARALLEL_ASI_H
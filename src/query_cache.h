@@ -0,0 +1,318 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <cmath>
+#include <list>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Bounded LRU cache of query results in front of a QuadTree.
+     *
+     * Query rectangles are snapped outwards to a grid of size `step`, so nearly identical viewports share one entry.
+     * A query is answered from the cache when its snapped rectangle was seen before, or when any cached rectangle
+     * contains it; the cached superset is then filtered down to the exact rectangle. Updates made through `insert()`
+     * only drop the entries whose rectangle contains the new point.
+     */
+    class QueryCache
+    {
+    public:
+        /**
+         * Constructor of the query cache. The tree is not owned and must outlive the cache.
+         *
+         * @param tree: index to answer cache misses
+         * @param maxEntries: maximum number of cached rectangles
+         * @param step: quantization step of the rectangle coordinates
+         */
+        QueryCache(QuadTree& tree, const size_t maxEntries, const double step) : tree(tree), maxEntries(maxEntries),
+            step(step)
+        {
+            if (maxEntries == 0)
+            {
+                throw std::invalid_argument("Cache must hold at least one entry.");
+            }
+            if (step <= 0)
+            {
+                throw std::invalid_argument("Quantization step must be positive.");
+            }
+        }
+
+        /**
+         * query the points inside a rectangle, from the cache if possible
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result)
+        {
+            const Key key = quantize(rect);
+            auto found = index.find(key);
+            if (found != index.end())
+            {
+                hit(found->second, rect, result);
+                return;
+            }
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if (contains(it->rect, rect))
+                {
+                    hit(it, rect, result);
+                    return;
+                }
+            }
+            ++missCount;
+            Entry entry{key, dequantize(key), {}};
+            tree.query(entry.rect, entry.points);
+            entry.points.shrink_to_fit();
+            filter(entry.points, rect, result);
+            bytes += bytes_of(entry);
+            entries.push_front(std::move(entry));
+            index[key] = entries.begin();
+            while (entries.size() > maxEntries)
+            {
+                erase(std::prev(entries.end()));
+            }
+        }
+
+        /**
+         * insert a point into the underlying tree and invalidate the cached rectangles containing it
+         *
+         * @param point: point to insert
+         * @return false if the point lies outside the tree
+         */
+        bool insert(const Point point)
+        {
+            if (!tree.insert(point))
+            {
+                return false;
+            }
+            invalidate(point);
+            return true;
+        }
+
+        /**
+         * drop every cached rectangle containing the point
+         *
+         * @param point: updated point
+         */
+        void invalidate(const Point point)
+        {
+            for (auto it = entries.begin(); it != entries.end();)
+            {
+                const Rectangle& r = it->rect;
+                if (point.x >= r.bottomLeft.x && point.x <= r.topRight.x && point.y >= r.bottomLeft.y &&
+                    point.y <= r.topRight.y)
+                {
+                    it = erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        /**
+         * drop every cached rectangle
+         */
+        void clear()
+        {
+            entries.clear();
+            index.clear();
+            bytes = 0;
+        }
+
+        [[nodiscard]] size_t hits() const
+        {
+            return hitCount;
+        }
+
+        [[nodiscard]] size_t misses() const
+        {
+            return missCount;
+        }
+
+        /**
+         * @return fraction of queries answered from the cache
+         */
+        [[nodiscard]] double hitRate() const
+        {
+            const size_t total = hitCount + missCount;
+            return total == 0 ? 0.0 : static_cast<double>(hitCount) / static_cast<double>(total);
+        }
+
+        /**
+         * @return bytes held by the cached entries
+         */
+        [[nodiscard]] size_t bytesUsed() const
+        {
+            return bytes;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return entries.size();
+        }
+
+    private:
+        struct Key
+        {
+            long long x_min;
+            long long y_min;
+            long long x_max;
+            long long y_max;
+
+            bool operator==(const Key& other) const
+            {
+                return x_min == other.x_min && y_min == other.y_min && x_max == other.x_max && y_max == other.y_max;
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const
+            {
+                size_t h = std::hash<long long>()(key.x_min);
+                h = h * 31 + std::hash<long long>()(key.y_min);
+                h = h * 31 + std::hash<long long>()(key.x_max);
+                h = h * 31 + std::hash<long long>()(key.y_max);
+                return h;
+            }
+        };
+
+        struct Entry
+        {
+            Key key;
+            Rectangle rect;
+            std::vector<Point> points;
+        };
+
+        using Iterator = std::list<Entry>::iterator;
+
+        QuadTree& tree;
+        const size_t maxEntries;
+        const double step;
+        std::list<Entry> entries{};
+        std::unordered_map<Key, Iterator, KeyHash> index{};
+        size_t hitCount = 0;
+        size_t missCount = 0;
+        size_t bytes = 0;
+
+        [[nodiscard]] Key quantize(const Rectangle rect) const
+        {
+            return Key{
+                static_cast<long long>(std::floor(rect.bottomLeft.x / step)),
+                static_cast<long long>(std::floor(rect.bottomLeft.y / step)),
+                static_cast<long long>(std::ceil(rect.topRight.x / step)),
+                static_cast<long long>(std::ceil(rect.topRight.y / step))
+            };
+        }
+
+        [[nodiscard]] Rectangle dequantize(const Key key) const
+        {
+            return Rectangle(Point(static_cast<double>(key.x_min) * step, static_cast<double>(key.y_min) * step),
+                             Point(static_cast<double>(key.x_max) * step, static_cast<double>(key.y_max) * step));
+        }
+
+        void hit(const Iterator it, const Rectangle rect, std::vector<Point>& result)
+        {
+            ++hitCount;
+            entries.splice(entries.begin(), entries, it);
+            filter(it->points, rect, result);
+        }
+
+        Iterator erase(const Iterator it)
+        {
+            bytes -= bytes_of(*it);
+            index.erase(it->key);
+            return entries.erase(it);
+        }
+
+        static bool contains(const Rectangle outer, const Rectangle inner)
+        {
+            return outer.bottomLeft.x <= inner.bottomLeft.x && outer.topRight.x >= inner.topRight.x &&
+                outer.bottomLeft.y <= inner.bottomLeft.y && outer.topRight.y >= inner.topRight.y;
+        }
+
+        static void filter(const std::vector<Point>& points, const Rectangle rect, std::vector<Point>& result)
+        {
+            const double x_min = rect.bottomLeft.x;
+            const double x_max = rect.topRight.x;
+            const double y_min = rect.bottomLeft.y;
+            const double y_max = rect.topRight.y;
+            for (Point point : points)
+            {
+                if (point.x >= x_min && point.x <= x_max && point.y >= y_min && point.y <= y_max)
+                {
+                    result.push_back(point);
+                }
+            }
+        }
+
+        static size_t bytes_of(const Entry& entry)
+        {
+            return sizeof(Entry) + sizeof(Iterator) + entry.points.capacity() * sizeof(Point);
+        }
+    };
+}
+
+UTEST(QueryCache, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(1000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 16);
+    alg::QueryCache cache(root, 4, 0.25);
+    const alg::Rectangle rect{alg::Point{-0.5, -0.5}, alg::Point{0.3, 0.4}};
+    const alg::Rectangle inner{alg::Point{-0.4, -0.4}, alg::Point{0.2, 0.2}};
+    std::vector<alg::Point> expected{};
+    root.query(rect, expected);
+    std::vector<alg::Point> first{};
+    std::vector<alg::Point> second{};
+    std::vector<alg::Point> contained{};
+    cache.query(rect, first);
+    cache.query(rect, second);
+    cache.query(inner, contained);
+    std::vector<alg::Point> expectedInner{};
+    root.query(inner, expectedInner);
+    EXPECT_EQ(first.size(), expected.size());
+    EXPECT_EQ(second.size(), expected.size());
+    EXPECT_EQ(contained.size(), expectedInner.size());
+    EXPECT_EQ(cache.hits(), 2u);
+    EXPECT_EQ(cache.misses(), 1u);
+    EXPECT_TRUE(cache.bytesUsed() > 0);
+}
+
+UTEST(QueryCache, Invalidate)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(1000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 16);
+    alg::QueryCache cache(root, 4, 0.25);
+    const alg::Rectangle left{alg::Point{-0.9, -0.9}, alg::Point{-0.1, 0.9}};
+    const alg::Rectangle right{alg::Point{0.1, -0.9}, alg::Point{0.9, 0.9}};
+    std::vector<alg::Point> result{};
+    cache.query(left, result);
+    cache.query(right, result);
+    EXPECT_TRUE(cache.insert(alg::Point{0.5, 0.5}));
+    EXPECT_EQ(cache.size(), 1u);
+    std::vector<alg::Point> updated{};
+    std::vector<alg::Point> expected{};
+    cache.query(right, updated);
+    root.query(right, expected);
+    EXPECT_EQ(updated.size(), expected.size());
+    EXPECT_EQ(cache.misses(), 3u);
+}
+
+#endif //QUERY_CACHE_H
@@ -0,0 +1,277 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef QUERY_CURSOR_H
+#define QUERY_CURSOR_H
+
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Resumable range query over a QuadTree.
+     *
+     * The cursor keeps the traversal stack of `QuadTree::query()` explicitly, so hits can be pulled in batches with
+     * `next()` and the memory held per query does not depend on the size of the result. The points come out in the same
+     * order as `QuadTree::query()` returns them. The state can be serialized and restored against the same tree, nodes
+     * are identified by their path from the root.
+     */
+    class QueryCursor
+    {
+    public:
+        /**
+         * Constructor of the cursor. The tree is not owned and must not change while the cursor is in use.
+         *
+         * @param tree: index to traverse
+         * @param rect: query rectangle
+         */
+        QueryCursor(const QuadTree& tree, const Rectangle rect) : rect(rect)
+        {
+            stack.push_back(Frame{&tree, "", 0, PENDING});
+        }
+
+        /**
+         * fetch the next batch of hits
+         *
+         * @param batchSize: maximum number of points to return
+         * @return up to `batchSize` points, empty once the traversal is finished
+         */
+        std::vector<Point> next(const size_t batchSize)
+        {
+            std::vector<Point> batch{};
+            batch.reserve(batchSize);
+            while (!stack.empty() && batch.size() < batchSize)
+            {
+                Frame& frame = stack.back();
+                const QuadTree& node = *frame.node;
+                if (frame.mode == PENDING)
+                {
+                    if (!intersects(node.rect))
+                    {
+                        stack.pop_back();
+                    }
+                    else if (includes(node.rect))
+                    {
+                        frame.mode = WHOLE;
+                    }
+                    else if (node.isLeaf)
+                    {
+                        frame.mode = SCAN;
+                    }
+                    else
+                    {
+                        // children are pushed in reverse so they pop in the order of QuadTree::query()
+                        const Frame parent = frame;
+                        stack.pop_back();
+                        for (int i = 3; i >= 0; --i)
+                        {
+                            stack.push_back(Frame{child(*parent.node, i), parent.path + std::to_string(i), 0, PENDING});
+                        }
+                    }
+                    continue;
+                }
+                const std::vector<Point>& points = node.points;
+                while (frame.offset < points.size() && batch.size() < batchSize)
+                {
+                    const Point point = points[frame.offset++];
+                    if (frame.mode == WHOLE || contains(point))
+                    {
+                        batch.push_back(point);
+                    }
+                }
+                if (frame.offset == points.size())
+                {
+                    stack.pop_back();
+                }
+            }
+            return batch;
+        }
+
+        /**
+         * @return true once every hit has been returned
+         */
+        [[nodiscard]] bool done() const
+        {
+            return stack.empty();
+        }
+
+        /**
+         * serialize the traversal state
+         *
+         * @return text that `deserialize()` turns back into an equivalent cursor
+         */
+        [[nodiscard]] std::string serialize() const
+        {
+            std::ostringstream os;
+            os.precision(std::numeric_limits<double>::max_digits10);
+            os << rect.bottomLeft.x << ' ' << rect.bottomLeft.y << ' ' << rect.topRight.x << ' ' << rect.topRight.y
+                << ' ' << stack.size() << '\n';
+            for (const Frame& frame : stack)
+            {
+                os << (frame.path.empty() ? "-" : frame.path) << ' ' << frame.offset << ' ' << frame.mode << '\n';
+            }
+            return os.str();
+        }
+
+        /**
+         * restore a cursor from `serialize()` output
+         *
+         * @param tree: the tree the cursor was created on
+         * @param state: serialized traversal state
+         * @return cursor continuing where the serialized one stopped
+         */
+        static QueryCursor deserialize(const QuadTree& tree, const std::string& state)
+        {
+            std::istringstream is(state);
+            Rectangle rect;
+            size_t frames = 0;
+            if (!(is >> rect.bottomLeft.x >> rect.bottomLeft.y >> rect.topRight.x >> rect.topRight.y >> frames))
+            {
+                throw std::invalid_argument("Malformed cursor state.");
+            }
+            QueryCursor cursor(tree, rect);
+            cursor.stack.clear();
+            for (size_t i = 0; i < frames; ++i)
+            {
+                std::string path;
+                size_t offset = 0;
+                int mode = 0;
+                if (!(is >> path >> offset >> mode) || mode < PENDING || mode > SCAN)
+                {
+                    throw std::invalid_argument("Malformed cursor state.");
+                }
+                if (path == "-")
+                {
+                    path.clear();
+                }
+                const QuadTree* node = &tree;
+                for (const char c : path)
+                {
+                    if (c < '0' || c > '3' || node->isLeaf)
+                    {
+                        throw std::invalid_argument("Cursor state does not match the tree.");
+                    }
+                    node = child(*node, c - '0');
+                }
+                if (offset > node->points.size())
+                {
+                    throw std::invalid_argument("Cursor state does not match the tree.");
+                }
+                cursor.stack.push_back(Frame{node, path, offset, static_cast<Mode>(mode)});
+            }
+            return cursor;
+        }
+
+    private:
+        enum Mode
+        {
+            // not yet tested against the query rectangle
+            PENDING = 0,
+            // node inside the query rectangle, every point is a hit
+            WHOLE = 1,
+            // leaf crossing the query rectangle, points are filtered
+            SCAN = 2
+        };
+
+        struct Frame
+        {
+            const QuadTree* node;
+            std::string path;
+            size_t offset;
+            Mode mode;
+        };
+
+        Rectangle rect;
+        std::vector<Frame> stack{};
+
+        static const QuadTree* child(const QuadTree& node, const int i)
+        {
+            switch (i)
+            {
+            case 0:
+                return node.topLeft.get();
+            case 1:
+                return node.topRight.get();
+            case 2:
+                return node.bottomLeft.get();
+            default:
+                return node.bottomRight.get();
+            }
+        }
+
+        [[nodiscard]] bool intersects(const Rectangle other) const
+        {
+            return !(rect.topRight.x < other.bottomLeft.x || rect.bottomLeft.x > other.topRight.x ||
+                rect.topRight.y < other.bottomLeft.y || rect.bottomLeft.y > other.topRight.y);
+        }
+
+        [[nodiscard]] bool includes(const Rectangle other) const
+        {
+            return rect.bottomLeft.x <= other.bottomLeft.x && rect.topRight.x >= other.topRight.x &&
+                rect.bottomLeft.y <= other.bottomLeft.y && rect.topRight.y >= other.topRight.y;
+        }
+
+        [[nodiscard]] bool contains(const Point point) const
+        {
+            return point.x >= rect.bottomLeft.x && point.x <= rect.topRight.x && point.y >= rect.bottomLeft.y &&
+                point.y <= rect.topRight.y;
+        }
+    };
+}
+
+UTEST(QueryCursor, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(5000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    const alg::Rectangle rect{alg::Point{-1.0, -0.5}, alg::Point{0.7, 1.5}};
+    std::vector<alg::Point> expected{};
+    root.query(rect, expected);
+    alg::QueryCursor cursor(root, rect);
+    std::vector<alg::Point> result{};
+    while (!cursor.done())
+    {
+        auto batch = cursor.next(100);
+        EXPECT_LE(batch.size(), 100u);
+        result.insert(result.end(), batch.begin(), batch.end());
+    }
+    ASSERT_EQ(result.size(), expected.size());
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        EXPECT_EQ(result[i].x, expected[i].x);
+        EXPECT_EQ(result[i].y, expected[i].y);
+    }
+}
+
+UTEST(QueryCursor, Resume)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(5000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    const alg::Rectangle rect{alg::Point{-1.0, -0.5}, alg::Point{0.7, 1.5}};
+    std::vector<alg::Point> expected{};
+    root.query(rect, expected);
+    alg::QueryCursor cursor(root, rect);
+    std::vector<alg::Point> result = cursor.next(333);
+    alg::QueryCursor resumed = alg::QueryCursor::deserialize(root, cursor.serialize());
+    while (!resumed.done())
+    {
+        auto batch = resumed.next(250);
+        result.insert(result.end(), batch.begin(), batch.end());
+    }
+    ASSERT_EQ(result.size(), expected.size());
+    EXPECT_EQ(result.back().x, expected.back().x);
+    EXPECT_EQ(result.back().y, expected.back().y);
+}
+
+#endif //QUERY_CURSOR_H
@@ -0,0 +1,265 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Histogram of a count with power of two buckets: bucket 0 holds 0, bucket i holds [2^(i-1), 2^i)
+     */
+    struct CountHistogram
+    {
+        static constexpr size_t BUCKETS = 40;
+
+        std::array<size_t, BUCKETS> buckets{};
+        size_t samples = 0;
+        size_t total = 0;
+        size_t max = 0;
+
+        void add(const size_t value)
+        {
+            size_t bucket = 0;
+            for (size_t v = value; v > 0 && bucket + 1 < BUCKETS; v >>= 1)
+            {
+                ++bucket;
+            }
+            ++buckets[bucket];
+            ++samples;
+            total += value;
+            max = std::max(max, value);
+        }
+    };
+
+    /**
+     * Aggregated counters of many QuadTree queries.
+     *
+     * Every recorded query adds its QueryCounters to one histogram per counter. Two ratios are kept as well: the
+     * pruning efficiency, the share of visited nodes that were pruned or accepted whole instead of scanned, and the
+     * leaf selectivity, the share of tested leaf points that were hits. The queries that tested the most points without
+     * hitting them are kept with their rectangles, so pathological query shapes can be found in a trace.
+     */
+    class QueryProfile
+    {
+    public:
+        struct Worst
+        {
+            Rectangle rect;
+            QueryCounters counters;
+        };
+
+        // buckets of the ratio histograms, bucket i holds [i / RATIO_BUCKETS, (i + 1) / RATIO_BUCKETS)
+        static constexpr size_t RATIO_BUCKETS = 10;
+
+        /**
+         * Constructor of the profile.
+         *
+         * @param keepWorst: number of most wasteful queries kept
+         */
+        explicit QueryProfile(const size_t keepWorst = 8) : keepWorst(keepWorst)
+        {
+        }
+
+        /**
+         * run an instrumented query and record it
+         *
+         * @param tree: tree to query
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         * @return counters of this query
+         */
+        QueryCounters query(QuadTree& tree, const Rectangle rect, std::vector<Point>& result)
+        {
+            QueryCounters counters;
+            tree.query(rect, result, counters);
+            record(rect, counters);
+            return counters;
+        }
+
+        /**
+         * record the counters of one query
+         *
+         * @param rect: query rectangle
+         * @param counters: counters filled by `QuadTree::query(rect, result, counters)`
+         */
+        void record(const Rectangle rect, const QueryCounters& counters)
+        {
+            nodesVisited.add(counters.nodesVisited);
+            nodesAccepted.add(counters.nodesAccepted);
+            nodesPruned.add(counters.nodesPruned);
+            pointsTested.add(counters.pointsTested);
+            hits.add(counters.hits);
+            bytesAppended.add(counters.bytesAppended);
+            if (counters.nodesVisited > 0)
+            {
+                addRatio(pruning, static_cast<double>(counters.nodesPruned + counters.nodesAccepted) /
+                         static_cast<double>(counters.nodesVisited));
+            }
+            if (counters.pointsTested > 0)
+            {
+                addRatio(selectivity, static_cast<double>(counters.hits - counters.pointsAccepted) /
+                         static_cast<double>(counters.pointsTested));
+            }
+            if (keepWorst == 0)
+            {
+                return;
+            }
+            const auto less = [](const Worst& l, const Worst& r) { return wasted(l.counters) > wasted(r.counters); };
+            const Worst entry{rect, counters};
+            if (worst.size() < keepWorst)
+            {
+                worst.insert(std::upper_bound(worst.begin(), worst.end(), entry, less), entry);
+            }
+            else if (wasted(counters) > wasted(worst.back().counters))
+            {
+                worst.pop_back();
+                worst.insert(std::upper_bound(worst.begin(), worst.end(), entry, less), entry);
+            }
+        }
+
+        [[nodiscard]] size_t queries() const
+        {
+            return nodesVisited.samples;
+        }
+
+        /**
+         * @return queries that tested the most points that were not hits, most wasteful first
+         */
+        [[nodiscard]] const std::vector<Worst>& worstQueries() const
+        {
+            return worst;
+        }
+
+        /**
+         * export the histograms
+         *
+         * @return JSON object with one entry per counter and ratio, and the most wasteful queries
+         */
+        [[nodiscard]] std::string toJson() const
+        {
+            std::ostringstream os;
+            os.precision(std::numeric_limits<double>::max_digits10);
+            os << "{\"queries\":" << queries();
+            writeCounts(os, "nodesVisited", nodesVisited);
+            writeCounts(os, "nodesAccepted", nodesAccepted);
+            writeCounts(os, "nodesPruned", nodesPruned);
+            writeCounts(os, "pointsTested", pointsTested);
+            writeCounts(os, "hits", hits);
+            writeCounts(os, "bytesAppended", bytesAppended);
+            writeRatios(os, "pruningEfficiency", pruning);
+            writeRatios(os, "leafSelectivity", selectivity);
+            os << ",\"worst\":[";
+            for (size_t i = 0; i < worst.size(); ++i)
+            {
+                const Rectangle& r = worst[i].rect;
+                const QueryCounters& c = worst[i].counters;
+                os << (i ? "," : "") << "{\"rect\":[" << r.bottomLeft.x << ',' << r.bottomLeft.y << ',' << r.topRight.x
+                    << ',' << r.topRight.y << "],\"nodesVisited\":" << c.nodesVisited << ",\"pointsTested\":"
+                    << c.pointsTested << ",\"hits\":" << c.hits << '}';
+            }
+            os << "]}";
+            return os.str();
+        }
+
+    private:
+        const size_t keepWorst;
+        CountHistogram nodesVisited{};
+        CountHistogram nodesAccepted{};
+        CountHistogram nodesPruned{};
+        CountHistogram pointsTested{};
+        CountHistogram hits{};
+        CountHistogram bytesAppended{};
+        std::array<size_t, RATIO_BUCKETS> pruning{};
+        std::array<size_t, RATIO_BUCKETS> selectivity{};
+        std::vector<Worst> worst{};
+
+        /**
+         * leaf points tested that were not hits
+         */
+        static size_t wasted(const QueryCounters& c)
+        {
+            return c.pointsTested - (c.hits - c.pointsAccepted);
+        }
+
+        static void addRatio(std::array<size_t, RATIO_BUCKETS>& histogram, const double ratio)
+        {
+            const auto bucket = static_cast<size_t>(ratio * RATIO_BUCKETS);
+            ++histogram[std::min(bucket, RATIO_BUCKETS - 1)];
+        }
+
+        static void writeCounts(std::ostringstream& os, const char* name, const CountHistogram& h)
+        {
+            // trailing empty buckets are left out
+            size_t used = CountHistogram::BUCKETS;
+            while (used > 1 && h.buckets[used - 1] == 0)
+            {
+                --used;
+            }
+            os << ",\"" << name << "\":{\"total\":" << h.total << ",\"max\":" << h.max << ",\"mean\":"
+                << (h.samples ? static_cast<double>(h.total) / static_cast<double>(h.samples) : 0.0) << ",\"log2\":[";
+            for (size_t i = 0; i < used; ++i)
+            {
+                os << (i ? "," : "") << h.buckets[i];
+            }
+            os << "]}";
+        }
+
+        static void writeRatios(std::ostringstream& os, const char* name,
+                                const std::array<size_t, RATIO_BUCKETS>& histogram)
+        {
+            os << ",\"" << name << "\":[";
+            for (size_t i = 0; i < RATIO_BUCKETS; ++i)
+            {
+                os << (i ? "," : "") << histogram[i];
+            }
+            os << ']';
+        }
+    };
+}
+
+UTEST(QueryProfile, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    alg::QueryProfile profile(2);
+    const alg::Rectangle rects[3] = {
+        alg::Rectangle{alg::Point{-1.0, -0.5}, alg::Point{0.7, 1.5}},
+        alg::Rectangle{alg::Point{-10.0, -10.0}, alg::Point{10.0, 10.0}},
+        alg::Rectangle{alg::Point{20.0, 20.0}, alg::Point{21.0, 21.0}}
+    };
+    for (const alg::Rectangle rect : rects)
+    {
+        std::vector<alg::Point> expected{};
+        root.query(rect, expected);
+        std::vector<alg::Point> result{};
+        const alg::QueryCounters counters = profile.query(root, rect, result);
+        EXPECT_EQ(result.size(), expected.size());
+        EXPECT_EQ(counters.hits, result.size());
+        EXPECT_EQ(counters.bytesAppended, result.size() * sizeof(alg::Point));
+        EXPECT_EQ(counters.nodesVisited >= counters.nodesAccepted + counters.nodesPruned, true);
+    }
+    EXPECT_EQ(profile.queries(), 3u);
+    // the query covering everything is accepted at the root, the one outside is pruned there
+    EXPECT_EQ(profile.worstQueries().size(), 2u);
+    EXPECT_EQ(profile.worstQueries().front().rect.bottomLeft.x, -1.0);
+    const std::string json = profile.toJson();
+    EXPECT_NE(json.find("\"pointsTested\":{"), std::string::npos);
+    EXPECT_NE(json.find("\"pruningEfficiency\":["), std::string::npos);
+    EXPECT_NE(json.find("\"worst\":[{"), std::string::npos);
+}
+
+#endif //QUERY_STATS_H
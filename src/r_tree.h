@@ -0,0 +1,327 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef R_TREE_H
+#define R_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "parallel.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * R-tree over rectangles, bulk loaded with Sort-Tile-Recursive.
+     *
+     * Every level is packed to full fanout and stored as separate arrays of box coordinates, the children of a node are
+     * a contiguous range of the level below. Level 0 holds the entries themselves. Child boxes are tested in a branch
+     * free loop over those arrays, which the compiler can vectorize. Queries return the indices of the entries in the
+     * vector the tree was built from.
+     */
+    class RTree
+    {
+    public:
+        /**
+         * Constructor of the R-tree.
+         *
+         * @param rects: rectangles to index
+         * @param fanout: number of children per node
+         * @param threads: number of threads for sorting the slices, 0 for the hardware concurrency
+         */
+        explicit RTree(const std::vector<Rectangle>& rects, const int fanout = 16, const unsigned threads = 0) :
+            fanout(fanout), threads(threads)
+        {
+            if (fanout < 2)
+            {
+                throw std::invalid_argument("Fanout must be at least 2.");
+            }
+            std::vector<Item> items(rects.size());
+            for (size_t i = 0; i < rects.size(); ++i)
+            {
+                items[i] = Item{rects[i], i, 0, 0};
+            }
+            // pack level after level until a single root is left
+            while (true)
+            {
+                tile(items);
+                Level level{};
+                for (const Item& item : items)
+                {
+                    level.push(item);
+                }
+                levels.push_back(std::move(level));
+                if (items.size() <= 1)
+                {
+                    break;
+                }
+                std::vector<Item> parents{};
+                for (size_t first = 0; first < items.size(); first += fanout)
+                {
+                    const size_t count = std::min<size_t>(fanout, items.size() - first);
+                    Item parent{items[first].rect, 0, first, count};
+                    for (size_t i = first + 1; i < first + count; ++i)
+                    {
+                        parent.rect = merge(parent.rect, items[i].rect);
+                    }
+                    parents.push_back(parent);
+                }
+                items.swap(parents);
+            }
+        }
+
+        /**
+         * find the entries intersecting a rectangle
+         *
+         * @param rect: query rectangle
+         * @param ids: vector the indices of the entries are appended to
+         */
+        void intersecting(const Rectangle rect, std::vector<size_t>& ids) const
+        {
+            const auto test = [rect](const Level& level, const size_t i, const size_t n, uint8_t* mask)
+            {
+                level.intersects(rect, i, n, mask);
+            };
+            search(test, test, ids);
+        }
+
+        /**
+         * find the entries lying completely inside a rectangle
+         *
+         * @param rect: query rectangle
+         * @param ids: vector the indices of the entries are appended to
+         */
+        void contained(const Rectangle rect, std::vector<size_t>& ids) const
+        {
+            search([rect](const Level& level, const size_t i, const size_t n, uint8_t* mask)
+                   {
+                       level.intersects(rect, i, n, mask);
+                   },
+                   [rect](const Level& level, const size_t i, const size_t n, uint8_t* mask)
+                   {
+                       level.inside(rect, i, n, mask);
+                   }, ids);
+        }
+
+        /**
+         * find the entries containing a point
+         *
+         * @param point: query point
+         * @param ids: vector the indices of the entries are appended to
+         */
+        void stabbing(const Point point, std::vector<size_t>& ids) const
+        {
+            const auto test = [point](const Level& level, const size_t i, const size_t n, uint8_t* mask)
+            {
+                level.intersects(Rectangle(point, point), i, n, mask);
+            };
+            search(test, test, ids);
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return levels.empty() ? 0 : levels.front().ids.size();
+        }
+
+        /**
+         * @return number of levels including the entries
+         */
+        [[nodiscard]] size_t height() const
+        {
+            return levels.size();
+        }
+
+    private:
+        struct Item
+        {
+            Rectangle rect;
+            // index of the entry, only used on level 0
+            size_t id;
+            // children on the level below
+            size_t first;
+            size_t count;
+        };
+
+        struct Level
+        {
+            std::vector<double> min_x{};
+            std::vector<double> min_y{};
+            std::vector<double> max_x{};
+            std::vector<double> max_y{};
+            std::vector<size_t> ids{};
+            std::vector<size_t> first{};
+            std::vector<size_t> count{};
+
+            void push(const Item& item)
+            {
+                min_x.push_back(item.rect.bottomLeft.x);
+                min_y.push_back(item.rect.bottomLeft.y);
+                max_x.push_back(item.rect.topRight.x);
+                max_y.push_back(item.rect.topRight.y);
+                ids.push_back(item.id);
+                first.push_back(item.first);
+                count.push_back(item.count);
+            }
+
+            void intersects(const Rectangle rect, const size_t i, const size_t n, uint8_t* mask) const
+            {
+                const double* x0 = min_x.data() + i;
+                const double* y0 = min_y.data() + i;
+                const double* x1 = max_x.data() + i;
+                const double* y1 = max_y.data() + i;
+                for (size_t j = 0; j < n; ++j)
+                {
+                    mask[j] = static_cast<uint8_t>((x0[j] <= rect.topRight.x) & (x1[j] >= rect.bottomLeft.x) &
+                        (y0[j] <= rect.topRight.y) & (y1[j] >= rect.bottomLeft.y));
+                }
+            }
+
+            void inside(const Rectangle rect, const size_t i, const size_t n, uint8_t* mask) const
+            {
+                const double* x0 = min_x.data() + i;
+                const double* y0 = min_y.data() + i;
+                const double* x1 = max_x.data() + i;
+                const double* y1 = max_y.data() + i;
+                for (size_t j = 0; j < n; ++j)
+                {
+                    mask[j] = static_cast<uint8_t>((x0[j] >= rect.bottomLeft.x) & (x1[j] <= rect.topRight.x) &
+                        (y0[j] >= rect.bottomLeft.y) & (y1[j] <= rect.topRight.y));
+                }
+            }
+        };
+
+        const int fanout;
+        const unsigned threads;
+        // levels[0] holds the entries, levels.back() the root
+        std::vector<Level> levels{};
+
+        static Rectangle merge(const Rectangle a, const Rectangle b)
+        {
+            return Rectangle(Point(std::min(a.bottomLeft.x, b.bottomLeft.x), std::min(a.bottomLeft.y, b.bottomLeft.y)),
+                             Point(std::max(a.topRight.x, b.topRight.x), std::max(a.topRight.y, b.topRight.y)));
+        }
+
+        /**
+         * Sort-Tile-Recursive order: sort by center x, cut into sqrt(nodes) vertical slices of whole nodes and sort
+         * every slice by center y.
+         */
+        void tile(std::vector<Item>& items) const
+        {
+            const auto cx = [](const Item& item) { return item.rect.bottomLeft.x + item.rect.topRight.x; };
+            const auto cy = [](const Item& item) { return item.rect.bottomLeft.y + item.rect.topRight.y; };
+            std::sort(items.begin(), items.end(), [&](const Item& l, const Item& r) { return cx(l) < cx(r); });
+            const size_t nodes = (items.size() + fanout - 1) / fanout;
+            const auto slices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(nodes))));
+            const size_t sliceSize = ((nodes + slices - 1) / std::max<size_t>(1, slices)) * fanout;
+            if (sliceSize == 0)
+            {
+                return;
+            }
+            const size_t count = (items.size() + sliceSize - 1) / sliceSize;
+            parallelChunks(count, threads, 1, [&](size_t, size_t begin, size_t end)
+            {
+                for (size_t s = begin; s < end; ++s)
+                {
+                    auto from = items.begin() + static_cast<long>(s * sliceSize);
+                    auto to = items.begin() + static_cast<long>(std::min(items.size(), (s + 1) * sliceSize));
+                    std::sort(from, to, [&](const Item& l, const Item& r) { return cy(l) < cy(r); });
+                }
+            });
+        }
+
+        template <typename NodeTest, typename EntryTest>
+        void search(const NodeTest& nodeTest, const EntryTest& entryTest, std::vector<size_t>& ids) const
+        {
+            if (size() == 0)
+            {
+                return;
+            }
+            std::vector<uint8_t> mask(fanout);
+            // (level, node) pairs still to open
+            std::vector<std::pair<size_t, size_t>> stack{};
+            const size_t top = levels.size() - 1;
+            nodeTest(levels[top], 0, 1, mask.data());
+            if (top == 0)
+            {
+                entryTest(levels[0], 0, 1, mask.data());
+                if (mask[0]) ids.push_back(levels[0].ids[0]);
+                return;
+            }
+            if (mask[0]) stack.emplace_back(top, 0);
+            while (!stack.empty())
+            {
+                const auto [l, node] = stack.back();
+                stack.pop_back();
+                const Level& children = levels[l - 1];
+                const size_t first = levels[l].first[node];
+                const size_t n = levels[l].count[node];
+                if (l == 1)
+                {
+                    entryTest(children, first, n, mask.data());
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        if (mask[j]) ids.push_back(children.ids[first + j]);
+                    }
+                    continue;
+                }
+                nodeTest(children, first, n, mask.data());
+                for (size_t j = n; j > 0; --j)
+                {
+                    if (mask[j - 1]) stack.emplace_back(l - 1, first + j - 1);
+                }
+            }
+        }
+    };
+}
+
+UTEST(RTree, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addUniformPoints(20000, alg::Point{0.0, 0.0});
+    const auto corners = generator.takePoints();
+    std::vector<alg::Rectangle> rects{};
+    for (size_t i = 0; i < corners.size(); i += 2)
+    {
+        const alg::Point c = corners[i];
+        const double w = std::abs(corners[i + 1].x) * 0.2;
+        const double h = std::abs(corners[i + 1].y) * 0.2;
+        rects.emplace_back(alg::Point{c.x, c.y}, alg::Point{c.x + w, c.y + h});
+    }
+    const alg::RTree tree(rects, 8);
+    const alg::Rectangle query{alg::Point{-0.3, -0.2}, alg::Point{0.25, 0.4}};
+    const alg::Point stab{0.1, 0.1};
+    size_t intersecting = 0;
+    size_t contained = 0;
+    size_t stabbing = 0;
+    for (const alg::Rectangle& r : rects)
+    {
+        if (r.bottomLeft.x <= query.topRight.x && r.topRight.x >= query.bottomLeft.x &&
+            r.bottomLeft.y <= query.topRight.y && r.topRight.y >= query.bottomLeft.y) ++intersecting;
+        if (r.bottomLeft.x >= query.bottomLeft.x && r.topRight.x <= query.topRight.x &&
+            r.bottomLeft.y >= query.bottomLeft.y && r.topRight.y <= query.topRight.y) ++contained;
+        if (r.bottomLeft.x <= stab.x && r.topRight.x >= stab.x && r.bottomLeft.y <= stab.y &&
+            r.topRight.y >= stab.y) ++stabbing;
+    }
+    std::vector<size_t> ids{};
+    tree.intersecting(query, ids);
+    EXPECT_EQ(ids.size(), intersecting);
+    ids.clear();
+    tree.contained(query, ids);
+    EXPECT_EQ(ids.size(), contained);
+    for (const size_t id : ids)
+    {
+        EXPECT_TRUE(rects[id].bottomLeft.x >= query.bottomLeft.x && rects[id].topRight.y <= query.topRight.y);
+    }
+    ids.clear();
+    tree.stabbing(stab, ids);
+    EXPECT_EQ(ids.size(), stabbing);
+    EXPECT_TRUE(stabbing > 0);
+}
+
+#endif //R_TREE_H
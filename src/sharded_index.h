@@ -0,0 +1,412 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef SHARDED_INDEX_H
+#define SHARDED_INDEX_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Spatially sharded QuadTree.
+     *
+     * The bounding box is cut into `shards` regions by recursive median splits, so every shard holds about the same
+     * number of points. Shards are assigned to the NUMA nodes in turn. Each shard is built by the first of its workers
+     * and queried by a small pool of them, all pinned to the CPUs of its node, so the tree is allocated in that node's
+     * memory and stays there while every CPU of the node can serve it. A query is routed only to the shards whose tree
+     * rectangle it overlaps, and the partial results are merged in shard order.
+     */
+    class ShardedIndex
+    {
+    public:
+        /**
+         * Constructor of the sharded index. Returns once every shard is built.
+         *
+         * @param points: points to index
+         * @param shards: number of shards, at most the number of points, typically `nodeCount()`
+         * @param capacity: bucket capacity of the shard trees
+         * @param workers: worker threads per shard, 0 to share the CPUs of each node among its shards
+         */
+        ShardedIndex(std::vector<Point> points, const size_t shards, const int capacity, const unsigned workers = 0)
+        {
+            if (shards == 0 || shards > points.size())
+            {
+                throw std::invalid_argument("Number of shards must be between 1 and the number of points.");
+            }
+            std::vector<std::vector<Point>> parts{};
+            split(points, shards, parts);
+            const std::vector<std::vector<int>> nodes = numaNodes();
+            try
+            {
+                std::vector<std::future<void>> ready{};
+                for (size_t i = 0; i < parts.size(); ++i)
+                {
+                    this->shards.push_back(std::make_unique<Shard>());
+                    Shard* s = this->shards.back().get();
+                    auto built = std::make_shared<std::promise<void>>();
+                    ready.push_back(built->get_future());
+                    const std::vector<int>& cpus = nodes[i % nodes.size()];
+                    s->threads.emplace_back([s, built, cpus, capacity, part = std::move(parts[i])]() mutable
+                    {
+                        pin(cpus);
+                        try
+                        {
+                            // built on the worker so that the first touch places the tree on its node
+                            s->tree = std::make_unique<QuadTree>(part, capacity);
+                            std::vector<Point>().swap(part);
+                        }
+                        catch (...)
+                        {
+                            built->set_exception(std::current_exception());
+                            return;
+                        }
+                        built->set_value();
+                        s->serve();
+                    });
+                    const unsigned count = workers ? workers : share(cpus.size(), parts.size(), nodes.size(), i);
+                    for (unsigned w = 1; w < count; ++w)
+                    {
+                        s->threads.emplace_back([s, cpus]
+                        {
+                            pin(cpus);
+                            s->serve();
+                        });
+                    }
+                }
+                for (auto& f : ready)
+                {
+                    f.get();
+                }
+            }
+            catch (...)
+            {
+                shutdown();
+                throw;
+            }
+        }
+
+        ~ShardedIndex()
+        {
+            shutdown();
+        }
+
+        ShardedIndex(const ShardedIndex&) = delete;
+        ShardedIndex& operator=(const ShardedIndex&) = delete;
+
+        /**
+         * query the points inside a rectangle. Safe to call from several threads at once.
+         *
+         * @param rect: query rectangle
+         * @param result: vector the points are appended to
+         */
+        void query(const Rectangle rect, std::vector<Point>& result)
+        {
+            std::vector<std::future<std::vector<Point>>> parts{};
+            for (auto& shard : shards)
+            {
+                const Rectangle& r = shard->tree->rect;
+                if (rect.topRight.x < r.bottomLeft.x || rect.bottomLeft.x > r.topRight.x ||
+                    rect.topRight.y < r.bottomLeft.y || rect.bottomLeft.y > r.topRight.y)
+                {
+                    continue;
+                }
+                auto task = std::make_shared<std::packaged_task<std::vector<Point>()>>([s = shard.get(), rect]
+                {
+                    std::vector<Point> part{};
+                    s->tree->query(rect, part);
+                    return part;
+                });
+                parts.push_back(task->get_future());
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+                    shard->tasks.emplace_back([task] { (*task)(); });
+                }
+                shard->cv.notify_one();
+            }
+            for (auto& part : parts)
+            {
+                const std::vector<Point> points = part.get();
+                result.insert(result.end(), points.begin(), points.end());
+            }
+        }
+
+        [[nodiscard]] size_t shardCount() const
+        {
+            return shards.size();
+        }
+
+        /**
+         * @param i: index of the shard
+         * @return number of worker threads of the shard
+         */
+        [[nodiscard]] size_t workerCount(const size_t i) const
+        {
+            return shards[i]->threads.size();
+        }
+
+        /**
+         * @return number of NUMA nodes, 1 if the topology is unknown
+         */
+        static size_t nodeCount()
+        {
+            return numaNodes().size();
+        }
+
+        /**
+         * @param i: index of the shard
+         * @return bounding box of the points of the shard
+         */
+        [[nodiscard]] Rectangle region(const size_t i) const
+        {
+            return shards[i]->tree->rect;
+        }
+
+    private:
+        struct Shard
+        {
+            std::unique_ptr<QuadTree> tree;
+            std::vector<std::thread> threads;
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<std::function<void()>> tasks;
+            bool stop = false;
+
+            void serve()
+            {
+                while (true)
+                {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (tasks.empty())
+                        {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop_front();
+                    }
+                    task();
+                }
+            }
+        };
+
+        std::vector<std::unique_ptr<Shard>> shards{};
+
+        /**
+         * stop and join the workers of every shard, the queued tasks are served first
+         */
+        void shutdown()
+        {
+            for (auto& shard : shards)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+                    shard->stop = true;
+                }
+                shard->cv.notify_all();
+            }
+            for (auto& shard : shards)
+            {
+                for (auto& thread : shard->threads)
+                {
+                    thread.join();
+                }
+            }
+        }
+
+        /**
+         * default number of workers of a shard: the CPUs of its node, or of the machine if the topology is unknown,
+         * split evenly among the shards placed on that node
+         */
+        static unsigned share(const size_t cpus, const size_t shards, const size_t nodes, const size_t i)
+        {
+            const size_t available = cpus ? cpus : std::max(1u, std::thread::hardware_concurrency());
+            const size_t node = i % nodes;
+            const size_t sharing = shards / nodes + (node < shards % nodes ? 1 : 0);
+            return static_cast<unsigned>(std::max<size_t>(1, available / sharing));
+        }
+
+        /**
+         * cut the points at the median of the wider axis, giving each side a share of the shards proportional to its
+         * share of the points
+         */
+        static void split(std::vector<Point>& points, const size_t shards, std::vector<std::vector<Point>>& parts)
+        {
+            if (shards == 1)
+            {
+                parts.push_back(std::move(points));
+                return;
+            }
+            double x_min = points[0].x;
+            double x_max = points[0].x;
+            double y_min = points[0].y;
+            double y_max = points[0].y;
+            for (Point point : points)
+            {
+                x_min = std::min(x_min, point.x);
+                x_max = std::max(x_max, point.x);
+                y_min = std::min(y_min, point.y);
+                y_max = std::max(y_max, point.y);
+            }
+            const bool byX = x_max - x_min >= y_max - y_min;
+            const size_t left = shards / 2;
+            const auto mid = points.begin() + static_cast<long>(points.size() * left / shards);
+            std::nth_element(points.begin(), mid, points.end(), [byX](const Point& a, const Point& b)
+            {
+                return byX ? a.x < b.x : a.y < b.y;
+            });
+            std::vector<Point> upper(mid, points.end());
+            points.erase(mid, points.end());
+            split(points, left, parts);
+            split(upper, shards - left, parts);
+        }
+
+        /**
+         * @return CPUs of every NUMA node, a single node with no CPUs if the topology is unknown
+         */
+        static std::vector<std::vector<int>> numaNodes()
+        {
+            std::vector<std::vector<int>> nodes{};
+#ifdef __linux__
+            for (int node = 0;; ++node)
+            {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string list;
+                if (!file.is_open() || !std::getline(file, list))
+                {
+                    break;
+                }
+                // format: 0-3,8-11
+                std::vector<int> cpus{};
+                size_t pos = 0;
+                while (pos < list.size())
+                {
+                    size_t end = list.find(',', pos);
+                    if (end == std::string::npos) end = list.size();
+                    const std::string range = list.substr(pos, end - pos);
+                    const size_t dash = range.find('-');
+                    const int first = std::stoi(range.substr(0, dash));
+                    const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                    for (int cpu = first; cpu <= last; ++cpu)
+                    {
+                        cpus.push_back(cpu);
+                    }
+                    pos = end + 1;
+                }
+                nodes.push_back(cpus);
+            }
+#endif
+            if (nodes.empty())
+            {
+                nodes.emplace_back();
+            }
+            return nodes;
+        }
+
+        static void pin(const std::vector<int>& cpus)
+        {
+#ifdef __linux__
+            if (cpus.empty())
+            {
+                return;
+            }
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (const int cpu : cpus)
+            {
+                CPU_SET(cpu, &set);
+            }
+            // best effort, the worker keeps running unpinned if the CPUs are not available to the process
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+        }
+    };
+}
+
+UTEST(ShardedIndex, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    generator.addNormalPoints(5000, alg::Point{5.0, 1.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    alg::ShardedIndex index(points, 6, 32);
+    EXPECT_EQ(index.shardCount(), 6u);
+    const alg::Rectangle rects[3] = {
+        alg::Rectangle{alg::Point{-1.0, -1.0}, alg::Point{0.5, 2.0}},
+        alg::Rectangle{alg::Point{-10.0, -10.0}, alg::Point{10.0, 10.0}},
+        alg::Rectangle{alg::Point{4.5, 0.8}, alg::Point{4.6, 1.3}}
+    };
+    for (const alg::Rectangle rect : rects)
+    {
+        std::vector<alg::Point> expected{};
+        root.query(rect, expected);
+        std::vector<alg::Point> result{};
+        index.query(rect, result);
+        EXPECT_EQ(result.size(), expected.size());
+    }
+}
+
+UTEST(ShardedIndex, Workers)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    alg::QuadTree root(points, 32);
+    // one shard per node, each served by a pool of workers
+    alg::ShardedIndex index(points, alg::ShardedIndex::nodeCount(), 32, 3);
+    for (size_t i = 0; i < index.shardCount(); ++i)
+    {
+        EXPECT_EQ(index.workerCount(i), 3u);
+    }
+    const alg::Rectangle rect{alg::Point{-1.0, -1.0}, alg::Point{0.5, 2.0}};
+    std::vector<alg::Point> expected{};
+    root.query(rect, expected);
+    std::vector<size_t> sizes(4);
+    std::vector<std::thread> clients{};
+    for (size_t t = 0; t < sizes.size(); ++t)
+    {
+        clients.emplace_back([&, t]
+        {
+            for (int i = 0; i < 20; ++i)
+            {
+                std::vector<alg::Point> result{};
+                index.query(rect, result);
+                sizes[t] += result.size();
+            }
+        });
+    }
+    for (auto& client : clients)
+    {
+        client.join();
+    }
+    for (const size_t size : sizes)
+    {
+        EXPECT_EQ(size, 20 * expected.size());
+    }
+}
+
+#endif //SHARDED_INDEX_H
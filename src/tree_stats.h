@@ -0,0 +1,168 @@
+//
+// Created by Yunhao Xu on 26-10-19.
+//
+
+#ifndef TREE_STATS_H
+#define TREE_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bucket_quadtrees.h"
+#include "utilities/utest.h"
+
+namespace alg
+{
+    /**
+     * Shape and memory footprint of a QuadTree.
+     *
+     * The tree is walked once in place, nothing is copied. Every inner node of a QuadTree keeps the points of its whole
+     * subtree, so `storedPoints` counts each point once per level it appears on and `duplication()` shows how many
+     * copies the tree holds per distinct point. Bytes are split into the node objects, the used part of the point and
+     * sample vectors, and the slack between their size and capacity.
+     */
+    struct TreeStats
+    {
+        // buckets of the leaf occupancy histogram, bucket i holds leaves filled to [i / 10, (i + 1) / 10) of capacity
+        static constexpr size_t OCCUPANCY_BUCKETS = 10;
+
+        size_t nodes = 0;
+        size_t leaves = 0;
+        size_t emptyLeaves = 0;
+        // leaves holding more than `capacity` points
+        size_t overfullLeaves = 0;
+        int maxDepth = 0;
+        // number of leaves on every depth, the root is on depth 0
+        std::vector<size_t> leafDepths{};
+        std::array<size_t, OCCUPANCY_BUCKETS> occupancy{};
+        // points in the root
+        size_t points = 0;
+        // points in all nodes
+        size_t storedPoints = 0;
+        size_t nodeBytes = 0;
+        size_t pointBytes = 0;
+        size_t slackBytes = 0;
+
+        /**
+         * Constructor of the statistics.
+         *
+         * @param tree: tree to measure
+         */
+        explicit TreeStats(const QuadTree& tree)
+        {
+            points = tree.points.size();
+            std::vector<std::pair<const QuadTree*, int>> stack{{&tree, 0}};
+            while (!stack.empty())
+            {
+                const auto [node, depth] = stack.back();
+                stack.pop_back();
+                ++nodes;
+                maxDepth = std::max(maxDepth, depth);
+                storedPoints += node->points.size();
+                nodeBytes += sizeof(QuadTree);
+                pointBytes += (node->points.size() + node->sample.size()) * sizeof(Point);
+                slackBytes += (node->points.capacity() - node->points.size() + node->sample.capacity() -
+                    node->sample.size()) * sizeof(Point);
+                if (!node->isLeaf)
+                {
+                    stack.emplace_back(node->bottomRight.get(), depth + 1);
+                    stack.emplace_back(node->bottomLeft.get(), depth + 1);
+                    stack.emplace_back(node->topRight.get(), depth + 1);
+                    stack.emplace_back(node->topLeft.get(), depth + 1);
+                    continue;
+                }
+                ++leaves;
+                if (leafDepths.size() <= static_cast<size_t>(depth))
+                {
+                    leafDepths.resize(depth + 1);
+                }
+                ++leafDepths[depth];
+                const size_t size = node->points.size();
+                const auto capacity = static_cast<size_t>(std::max(node->capacity, 1));
+                if (size == 0)
+                {
+                    ++emptyLeaves;
+                }
+                if (size > capacity)
+                {
+                    ++overfullLeaves;
+                }
+                const size_t bucket = size * OCCUPANCY_BUCKETS / capacity;
+                ++occupancy[std::min(bucket, OCCUPANCY_BUCKETS - 1)];
+            }
+        }
+
+        [[nodiscard]] double emptyLeafRatio() const
+        {
+            return leaves ? static_cast<double>(emptyLeaves) / static_cast<double>(leaves) : 0.0;
+        }
+
+        /**
+         * @return stored copies per distinct point, 1 when only leaves would hold points
+         */
+        [[nodiscard]] double duplication() const
+        {
+            return points ? static_cast<double>(storedPoints) / static_cast<double>(points) : 0.0;
+        }
+
+        [[nodiscard]] size_t totalBytes() const
+        {
+            return nodeBytes + pointBytes + slackBytes;
+        }
+
+        /**
+         * @return JSON object with every statistic
+         */
+        [[nodiscard]] std::string toJson() const
+        {
+            std::ostringstream os;
+            os.precision(std::numeric_limits<double>::max_digits10);
+            os << "{\"nodes\":" << nodes << ",\"leaves\":" << leaves << ",\"emptyLeaves\":" << emptyLeaves
+                << ",\"emptyLeafRatio\":" << emptyLeafRatio() << ",\"overfullLeaves\":" << overfullLeaves
+                << ",\"maxDepth\":" << maxDepth << ",\"leafDepths\":[";
+            for (size_t i = 0; i < leafDepths.size(); ++i)
+            {
+                os << (i ? "," : "") << leafDepths[i];
+            }
+            os << "],\"occupancy\":[";
+            for (size_t i = 0; i < OCCUPANCY_BUCKETS; ++i)
+            {
+                os << (i ? "," : "") << occupancy[i];
+            }
+            os << "],\"points\":" << points << ",\"storedPoints\":" << storedPoints << ",\"duplication\":"
+                << duplication() << ",\"bytes\":{\"nodes\":" << nodeBytes << ",\"points\":" << pointBytes
+                << ",\"slack\":" << slackBytes << ",\"total\":" << totalBytes() << "}}";
+            return os.str();
+        }
+    };
+}
+
+UTEST(TreeStats, Test)
+{
+    sf::RandomPointGenerator<alg::Point> generator{2024};
+    generator.addNormalPoints(20000, alg::Point{0.0, 0.0});
+    auto points = generator.takePoints();
+    const alg::QuadTree root(points, 32);
+    const alg::TreeStats stats(root);
+    EXPECT_EQ(stats.points, points.size());
+    EXPECT_EQ(stats.nodes, 4 * (stats.nodes - stats.leaves) + 1);
+    size_t leaves = 0;
+    for (const size_t n : stats.leafDepths)
+    {
+        leaves += n;
+    }
+    EXPECT_EQ(leaves, stats.leaves);
+    EXPECT_EQ(static_cast<int>(stats.leafDepths.size()), stats.maxDepth + 1);
+    EXPECT_EQ(stats.overfullLeaves, 0u);
+    // every point is stored once in the root and once more on every level down to its leaf
+    EXPECT_GT(stats.duplication(), 2.0);
+    EXPECT_EQ(stats.pointBytes >= stats.storedPoints * sizeof(alg::Point), true);
+    EXPECT_NE(stats.toJson().find("\"emptyLeafRatio\":"), std::string::npos);
+}
+
+#endif //TREE_STATS_H